@@ -1,9 +1,9 @@
 
 #include "ConfigFile.h"
-#include "config/ParseConfig.h"
 #include "common/output.h"
 #include <cstdio>
 #include <fstream>
+#include <functional>
 
 #if defined(_WIN32)
 
@@ -24,11 +24,23 @@ namespace {
       return { };
     return filetime_to_time_t(file_attr_data.ftLastWriteTime);
   }
+
+  std::optional<std::string> read_file(const std::filesystem::path& filename) {
+    auto is = std::ifstream(filename);
+    if (!is.good())
+      return { };
+    return std::string(std::istreambuf_iterator<char>(is), { });
+  }
 } // namespace
 
 #else // !defined(_WIN32)
 
 #include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 
 namespace {
   std::time_t get_modify_time(const std::string& filename) {
@@ -38,35 +50,355 @@ namespace {
       return st.st_mtime;
     return { };
   }
+
+  // maps the file to copy it at once, the copy is parsed, since the file
+  // can be modified at any time
+  std::optional<std::string> read_file(const std::filesystem::path& filename) {
+    const auto fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return { };
+    using stat_t = struct stat;
+    auto st = stat_t{ };
+    auto contents = std::optional<std::string>();
+    if (::fstat(fd, &st) == 0) {
+      const auto size = static_cast<size_t>(st.st_size);
+      if (size == 0) {
+        contents.emplace();
+      }
+      else if (const auto data = ::mmap(nullptr, size, PROT_READ,
+          MAP_PRIVATE, fd, 0); data != MAP_FAILED) {
+        contents.emplace(static_cast<const char*>(data), size);
+        ::munmap(data, size);
+      }
+    }
+    ::close(fd);
+    return contents;
+  }
+
+  std::filesystem::path get_directory(const std::filesystem::path& filename) {
+    const auto directory = filename.parent_path();
+    return (directory.empty() ? "." : directory);
+  }
 } // namespace
 
 #endif // !defined(_WIN32)
 
+#if !defined(_WIN32)
+
+ConfigFile::~ConfigFile() {
+  shutdown_parse_thread();
+  if (m_watch_fd >= 0)
+    ::close(m_watch_fd);
+  if (m_parsed_fds[0] >= 0) {
+    ::close(m_parsed_fds[0]);
+    ::close(m_parsed_fds[1]);
+  }
+}
+
+// watching directory, since editors often replace the file when saving,
+// when it is a symlink then also the directory of the target
+bool ConfigFile::add_watches() {
+  if (m_watch_fd >= 0)
+    ::close(m_watch_fd);
+  m_watch_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  m_watched_names.clear();
+  if (m_watch_fd < 0)
+    return false;
+
+  auto filenames = std::vector<std::filesystem::path>{ m_filename };
+  auto error = std::error_code{ };
+  if (std::filesystem::is_symlink(m_filename, error)) {
+    const auto target = std::filesystem::canonical(m_filename, error);
+    if (!error)
+      filenames.push_back(target);
+  }
+  for (const auto& [filename, modify_time] : m_included_files)
+    filenames.push_back(filename);
+
+  for (const auto& filename : filenames) {
+    if (::inotify_add_watch(m_watch_fd, get_directory(filename).c_str(),
+          IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE |
+          IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+      ::close(m_watch_fd);
+      m_watch_fd = -1;
+      m_watched_names.clear();
+      return false;
+    }
+    m_watched_names.push_back(filename.filename());
+  }
+  return true;
+}
+
+bool ConfigFile::watch_reported_change() {
+  auto changed = false;
+  auto rewatch = false;
+  alignas(inotify_event) char buffer[4096];
+  for (;;) {
+    const auto length = ::read(m_watch_fd, buffer, sizeof(buffer));
+    if (length == -1 && errno == EINTR)
+      continue;
+    if (length <= 0)
+      break;
+    for (auto offset = ssize_t{ }; offset < length; ) {
+      const auto& event = *reinterpret_cast<const inotify_event*>(buffer + offset);
+      if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+        rewatch = true;
+      if (event.mask & IN_Q_OVERFLOW)
+        changed = true;
+      if (event.len)
+        for (const auto& name : m_watched_names)
+          if (name == event.name) {
+            changed = true;
+            // symlink might have been changed to a new target
+            rewatch |= (name == m_filename.filename() &&
+              m_watched_names.size() > 1);
+          }
+      offset += static_cast<ssize_t>(sizeof(inotify_event) + event.len);
+    }
+  }
+  // directory was removed or replaced, falls back to polling when it fails
+  if (rewatch) {
+    add_watches();
+    changed = true;
+  }
+  return changed;
+}
+
+#else // defined(_WIN32)
+
+ConfigFile::~ConfigFile() {
+  shutdown_parse_thread();
+}
+
+#endif // !defined(_WIN32)
+
+void ConfigFile::shutdown_parse_thread() {
+  if (m_parse_thread.joinable()) {
+    {
+      auto lock = std::lock_guard(m_parse_mutex);
+      m_shutdown_parse_thread = true;
+    }
+    m_parse_condition.notify_all();
+    m_parse_thread.join();
+  }
+}
+
 bool ConfigFile::load(std::filesystem::path filename) {
   m_filename = std::move(filename);
   m_modify_time = { -1 };
-  return update();
+#if !defined(_WIN32)
+  add_watches();
+#endif
+  return update(false);
 }
 
-bool ConfigFile::update(bool check_modified) {
+std::optional<std::string> ConfigFile::read_modified(bool check_modified) {
+  const auto check_contents = check_modified;
+#if !defined(_WIN32)
+  if (check_modified && m_watch_fd >= 0) {
+    if (!watch_reported_change())
+      return { };
+    check_modified = false;
+  }
+#endif
   const auto modify_time = get_modify_time(m_filename);
+  const auto includes_modified = included_files_modified();
   if (check_modified && 
-      modify_time == m_modify_time)
-    return false;
+      modify_time == m_modify_time && !includes_modified)
+    return { };
   m_modify_time = modify_time;
+
+  auto contents = read_file(m_filename);
+  if (!contents) {
+    error("Opening configuration file failed");
+    return { };
+  }
+  // only parse when contents changed, not when file was just touched
+  const auto contents_hash = std::hash<std::string>()(*contents);
+  if (check_contents && contents_hash == m_contents_hash &&
+      !includes_modified)
+    return { };
+  m_contents_hash = contents_hash;
+  return contents;
+}
+
+// called by update and by the parse thread
+Config ConfigFile::parse_config(const std::string& contents,
+    std::vector<std::filesystem::path>* included_files) {
+  auto lock = std::lock_guard(m_parse_config_mutex);
   try {
-    auto is = std::ifstream(m_filename);
-    if (is.good()) {
-      auto parse = ParseConfig();
-      m_config = parse(is);
-      return true;
+    auto config = m_parse_config(std::string_view(contents),
+      m_filename.parent_path());
+    *included_files = m_parse_config.included_files();
+    m_optimizations = optimize_config(config);
+    return config;
+  }
+  catch (...) {
+    // also watch included files of invalid configurations
+    *included_files = m_parse_config.included_files();
+    throw;
+  }
+}
+
+void ConfigFile::report_optimizations() {
+  auto lock = std::lock_guard(m_parse_config_mutex);
+  const auto& optimizations = m_optimizations;
+  if (optimizations.shadowed_inputs)
+    message("Removed %d mappings shadowed by identical inputs",
+      optimizations.shadowed_inputs);
+  if (optimizations.unreachable_command_outputs)
+    message("Removed %d overridden or unused command mappings",
+      optimizations.unreachable_command_outputs);
+  if (optimizations.duplicate_outputs)
+    message("Merged %d duplicate outputs",
+      optimizations.duplicate_outputs);
+  if (optimizations.empty_contexts)
+    message("Removed %d contexts without reachable mappings",
+      optimizations.empty_contexts);
+}
+
+void ConfigFile::set_included_files(
+    std::vector<std::filesystem::path> filenames) {
+  auto included_files = decltype(m_included_files)();
+  for (auto& filename : filenames) {
+    const auto modify_time = get_modify_time(filename);
+    included_files.emplace_back(std::move(filename), modify_time);
+  }
+  const auto changed = (included_files.size() != m_included_files.size() ||
+    !std::equal(included_files.begin(), included_files.end(),
+      m_included_files.begin(), [](const auto& a, const auto& b) {
+        return a.first == b.first;
+      }));
+  m_included_files = std::move(included_files);
+#if !defined(_WIN32)
+  if (changed)
+    add_watches();
+#endif
+}
+
+bool ConfigFile::included_files_modified() {
+  auto modified = false;
+  for (auto& [filename, modify_time] : m_included_files)
+    if (const auto time = get_modify_time(filename); time != modify_time) {
+      modify_time = time;
+      modified = true;
     }
-    else {
-      error("Opening configuration file failed");
+  return modified;
+}
+
+bool ConfigFile::update(bool check_modified) {
+  auto included_files = std::vector<std::filesystem::path>();
+  try {
+    auto contents = read_modified(check_modified);
+    if (!contents)
+      return false;
+    m_config = parse_config(*contents, &included_files);
+    set_included_files(std::move(included_files));
+
+    // discard result of background parsing
+    if (m_parse_pending) {
+      auto lock = std::lock_guard(m_parse_mutex);
+      m_contents_to_parse.reset();
+      m_parsed = false;
+      m_parse_pending = false;
     }
+    return true;
   }
   catch (const std::exception& ex) {
     error("%s", ex.what());
+    set_included_files(std::move(included_files));
   }
   return false;
 }
+
+void ConfigFile::update_async() {
+  auto contents = read_modified(true);
+  if (!contents)
+    return;
+
+  if (!m_parse_thread.joinable()) {
+#if !defined(_WIN32)
+    if (::pipe2(m_parsed_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+      error("Creating parse notification failed");
+      return;
+    }
+#endif
+    m_parse_thread = std::thread(&ConfigFile::parse_thread, this);
+  }
+  {
+    auto lock = std::lock_guard(m_parse_mutex);
+    m_contents_to_parse = std::move(contents);
+    m_parsed = false;
+  }
+  m_parse_pending = true;
+  m_parse_condition.notify_all();
+}
+
+bool ConfigFile::get_parsed_config() {
+#if !defined(_WIN32)
+  // also discard notifications of parses which were superseded
+  char buffer[64];
+  while (m_parsed_fds[0] >= 0 &&
+         ::read(m_parsed_fds[0], buffer, sizeof(buffer)) > 0) { }
+#endif
+  if (!m_parse_pending)
+    return false;
+
+  auto lock = std::unique_lock(m_parse_mutex);
+  if (!m_parsed)
+    return false;
+  m_parsed = false;
+  m_parse_pending = false;
+  auto config = std::move(m_parsed_config);
+  auto parse_error = std::move(m_parse_error);
+  auto included_files = std::move(m_parsed_included_files);
+  lock.unlock();
+  set_included_files(std::move(included_files));
+
+  // previous configuration stays active when parsing failed
+  if (!config) {
+    error("%s", parse_error.c_str());
+    return false;
+  }
+  m_config = std::move(*config);
+  return true;
+}
+
+void ConfigFile::parse_thread() {
+  auto lock = std::unique_lock(m_parse_mutex);
+  for (;;) {
+    m_parse_condition.wait(lock, [&]() {
+      return m_shutdown_parse_thread || m_contents_to_parse.has_value();
+    });
+    if (m_shutdown_parse_thread)
+      return;
+
+    auto contents = std::move(*m_contents_to_parse);
+    m_contents_to_parse.reset();
+    lock.unlock();
+
+    auto config = std::optional<Config>();
+    auto parse_error = std::string();
+    auto included_files = std::vector<std::filesystem::path>();
+    try {
+      config = parse_config(contents, &included_files);
+    }
+    catch (const std::exception& ex) {
+      parse_error = ex.what();
+    }
+
+    lock.lock();
+    // only publish when it was not superseded in the meantime
+    if (!m_contents_to_parse) {
+      m_parsed_config = std::move(config);
+      m_parse_error = std::move(parse_error);
+      m_parsed_included_files = std::move(included_files);
+      m_parsed = true;
+#if !defined(_WIN32)
+      // wake up the main loop
+      const auto byte = char{ };
+      [[maybe_unused]] const auto result = ::write(m_parsed_fds[1], &byte, 1);
+#endif
+    }
+  }
+}
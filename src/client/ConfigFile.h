@@ -1,19 +1,77 @@
 #pragma once
 
 #include "config/Config.h"
+#include "config/ParseConfig.h"
+#include "config/optimize_config.h"
 #include <ctime>
 #include <string>
+#include <vector>
+#include <optional>
 #include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 class ConfigFile {
 public:
+  ConfigFile() = default;
+  ConfigFile(const ConfigFile&) = delete;
+  ConfigFile& operator=(const ConfigFile&) = delete;
+  ~ConfigFile();
+
   bool load(std::filesystem::path filename);
   bool update(bool check_modified = true);
+  // parses on a background thread, the current configuration stays
+  // active until the new one is swapped in by get_parsed_config
+  void update_async();
+  bool get_parsed_config();
   const Config& config() const { return m_config; }
   const std::filesystem::path& filename() { return m_filename; }
+  // what the optimizer removed from the last parsed configuration
+  void report_optimizations();
+#if !defined(_WIN32)
+  // descriptor which becomes readable when the file might have changed
+  int watch_fd() const { return m_watch_fd; }
+  // descriptor which becomes readable when a background parse finished
+  int parsed_fd() const { return m_parsed_fds[0]; }
+#endif
 
 private:
+  std::optional<std::string> read_modified(bool check_modified);
+  Config parse_config(const std::string& contents,
+    std::vector<std::filesystem::path>* included_files);
+  void set_included_files(std::vector<std::filesystem::path> filenames);
+  bool included_files_modified();
+  void parse_thread();
+  void shutdown_parse_thread();
+
   std::filesystem::path m_filename;
   std::time_t m_modify_time{ -1 };
+  size_t m_contents_hash{ };
+  std::vector<std::pair<std::filesystem::path, std::time_t>> m_included_files;
   Config m_config;
+  // reuses the unchanged contexts of the previous parse
+  std::mutex m_parse_config_mutex;
+  ParseConfig m_parse_config;
+  ConfigOptimizations m_optimizations{ };
+
+  // background configuration parsing
+  std::thread m_parse_thread;
+  std::mutex m_parse_mutex;
+  std::condition_variable m_parse_condition;
+  std::optional<std::string> m_contents_to_parse;
+  bool m_parsed{ };
+  std::optional<Config> m_parsed_config;
+  std::vector<std::filesystem::path> m_parsed_included_files;
+  std::string m_parse_error;
+  bool m_shutdown_parse_thread{ };
+  bool m_parse_pending{ };
+#if !defined(_WIN32)
+  bool add_watches();
+  bool watch_reported_change();
+
+  int m_watch_fd{ -1 };
+  std::vector<std::string> m_watched_names;
+  int m_parsed_fds[2]{ -1, -1 };
+#endif
 };
@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 class FocusedWindow {
 public:
@@ -16,6 +17,11 @@ public:
   const std::string& window_class() const;
   const std::string& window_title() const;
   bool is_inaccessible() const;
+#if !defined(_WIN32)
+  // adds descriptors which become readable when update should be called,
+  // returns false when a system can only be polled periodically
+  bool get_poll_fds(std::vector<int>* fds) const;
+#endif
 
 private:
   std::unique_ptr<class FocusedWindowImpl> m_impl;
@@ -1,49 +1,56 @@
 
 #include "ServerPort.h"
+#include "write_config.h"
 #include "config/Config.h"
 #include "common/MessageType.h"
+#include "common/output.h"
+#include <utility>
 
-namespace {
-  void write_key_sequence(Serializer& s, const KeySequence& sequence) {
-    s.write(static_cast<uint32_t>(sequence.size()));
-    for (const auto& event : sequence) {
-      s.write(event.key);
-      s.write(event.data);
-    }
-  }
+#if !defined(_WIN32)
+# include <cerrno>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
 
-  void write_config(Serializer& s, const Config& config) {
-    s.write(static_cast<uint32_t>(config.contexts.size()));
-    for (const auto& context : config.contexts) {
-      // inputs
-      s.write(static_cast<uint32_t>(context.inputs.size()));
-      for (const auto& input : context.inputs) {
-        write_key_sequence(s, input.input);
-        s.write(static_cast<int32_t>(input.output_index));
-      }
-
-      // outputs
-      s.write(static_cast<uint32_t>(context.outputs.size()));
-      for (const auto& output : context.outputs)
-        write_key_sequence(s, output);
+namespace {
+#if !defined(_WIN32)
+  // large configurations are passed in a sealed memory file
+  const auto min_memfd_config_size = size_t{ 64 * 1024 };
 
-      // command outputs
-      s.write(static_cast<uint32_t>(context.command_outputs.size()));
-      for (const auto& command : context.command_outputs) {
-        write_key_sequence(s, command.output);
-        s.write(static_cast<int32_t>(command.index));
+  int create_sealed_memfd(const char* data, size_t size) {
+    const auto fd = ::memfd_create("keymapper-config",
+      MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+      return -1;
+    while (size != 0) {
+      const auto result = ::write(fd, data, size);
+      if (result == -1 && errno == EINTR)
+        continue;
+      if (result <= 0) {
+        ::close(fd);
+        return -1;
       }
-
-      // device filter
-      s.write(static_cast<uint32_t>(context.device_filter.size()));
-      s.write(context.device_filter.data(), context.device_filter.size());
+      data += result;
+      size -= static_cast<size_t>(result);
+    }
+    if (::fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+          F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+      ::close(fd);
+      return -1;
     }
+    return fd;
   }
+#endif
 
+  // as a bitmask, one bit per context index
   void write_active_contexts(Serializer& s, const std::vector<int>& indices) {
-    s.write(static_cast<uint32_t>(indices.size()));
+    const auto words = (indices.empty() ? 0 : indices.back() / 64 + 1);
+    auto bits = std::vector<uint64_t>(static_cast<size_t>(words));
     for (const auto& index : indices)
-      s.write(static_cast<uint32_t>(index));
+      bits[index / 64] |= uint64_t{ 1 } << (index % 64);
+    s.write(static_cast<uint32_t>(bits.size()));
+    s.write(bits.data(), bits.size() * sizeof(uint64_t));
   }
 } // namespace
 
@@ -60,14 +67,65 @@ bool ServerPort::initialize() {
     return false;
 
   m_connection = std::move(connection);
+  m_config_version = { };
+  m_context_hashes.clear();
+  m_config_requested = false;
   return true;
 }
 
 bool ServerPort::send_config(const Config& config) {
-  return m_connection && m_connection->send_message([&](Serializer& s) {
-    s.write(MessageType::configuration);
-    write_config(s, config);
-  });
+  // send complete configuration when it was requested
+  if (std::exchange(m_config_requested, false))
+    m_context_hashes.clear();
+
+  const auto base_version =
+    (m_context_hashes.empty() ? uint32_t{ } : m_config_version);
+  const auto version = ++m_config_version;
+  auto context_hashes = std::vector<uint64_t>();
+  auto changed = 0;
+  if (!m_connection)
+    return false;
+
+#if !defined(_WIN32)
+  auto& s = m_config_buffer;
+  s.clear();
+  changed = write_config(s, config, base_version, version,
+    m_context_hashes, &context_hashes);
+  const auto fd = (s.size() >= min_memfd_config_size ?
+    create_sealed_memfd(s.data(), s.size()) : -1);
+  if (fd >= 0) {
+    const auto size = static_cast<uint64_t>(s.size());
+    const auto sent = m_connection->send_message_with_fd(fd,
+      [&](Serializer& message) {
+        message.write(MessageType::configuration);
+        message.write(ConfigTransfer::memfd);
+        message.write(size);
+      });
+    ::close(fd);
+    if (!sent)
+      return false;
+  }
+  else if (!m_connection->send_message([&](Serializer& message) {
+        message.write(MessageType::configuration);
+        message.write(ConfigTransfer::message);
+        message.write(s.data(), s.size());
+      })) {
+    return false;
+  }
+#else
+  if (!m_connection->send_message([&](Serializer& s) {
+        s.write(MessageType::configuration);
+        s.write(ConfigTransfer::message);
+        changed = write_config(s, config, base_version, version,
+          m_context_hashes, &context_hashes);
+      }))
+    return false;
+#endif
+
+  verbose("Sent %d of %d contexts", changed,
+    static_cast<int>(config.contexts.size()));
+  m_context_hashes = std::move(context_hashes);
+  return true;
 }
 
 bool ServerPort::send_active_contexts(const std::vector<int>& indices) {
@@ -83,9 +141,19 @@ bool ServerPort::send_validate_state() {
   });
 }
 
-bool ServerPort::receive_triggered_action(Duration timeout, int* triggered_action) {
+bool ServerPort::receive_triggered_action(Duration timeout, int* triggered_action,
+    Clock::time_point* triggered_time) {
   return m_connection && m_connection->read_messages(timeout,
-    [&](Deserializer& s) {
-      *triggered_action = static_cast<int>(s.read<uint32_t>());
+    [&](Deserializer& d) {
+      const auto message_type = d.read<MessageType>();
+      if (message_type == MessageType::triggered_action) {
+        *triggered_action = static_cast<int>(d.read<uint32_t>());
+        const auto time = d.read<uint64_t>();
+        if (triggered_time)
+          *triggered_time = Clock::time_point(Clock::duration(time));
+      }
+      else if (message_type == MessageType::configuration_request) {
+        m_config_requested = true;
+      }
     });
 }
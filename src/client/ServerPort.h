@@ -9,6 +9,11 @@ struct Config;
 class ServerPort {
 private:
   std::unique_ptr<Connection> m_connection;
+  // state of last configuration sent, to allow sending only changes
+  uint32_t m_config_version{ };
+  std::vector<uint64_t> m_context_hashes;
+  bool m_config_requested{ };
+  Serializer m_config_buffer;
 
 public:
   ServerPort();
@@ -21,5 +26,8 @@ public:
   bool send_config(const Config& config);
   bool send_active_contexts(const std::vector<int>& indices);
   bool send_validate_state();
-  bool receive_triggered_action(Duration timeout, int* triggered_action);
+  // the steady clock time of when the action was triggered is optionally returned
+  bool receive_triggered_action(Duration timeout, int* triggered_action,
+    Clock::time_point* triggered_time = nullptr);
+  bool config_requested() const { return m_config_requested; }
 };
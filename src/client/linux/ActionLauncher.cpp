@@ -0,0 +1,120 @@
+
+#include "ActionLauncher.h"
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+namespace {
+  int g_child_exited_fd = -1;
+
+  void catch_child([[maybe_unused]] int sig_num) {
+    const auto saved_errno = errno;
+    const auto byte = char{ };
+    [[maybe_unused]] const auto result = ::write(g_child_exited_fd, &byte, 1);
+    errno = saved_errno;
+  }
+
+  // when there are no special characters, the command is split at spaces
+  bool split_simple_command(const std::string& command,
+      std::vector<std::string>* arguments) {
+    if (command.find_first_of("|&;<>()$`\\\"'*?[]{}#~=%!\n") != std::string::npos)
+      return false;
+    auto begin = size_t{ };
+    for (;;) {
+      begin = command.find_first_not_of(" \t", begin);
+      if (begin == std::string::npos)
+        break;
+      const auto end = std::min(command.find_first_of(" \t", begin), command.size());
+      arguments->emplace_back(command.substr(begin, end - begin));
+      begin = end;
+    }
+    return !arguments->empty();
+  }
+
+  bool spawn(std::vector<std::string>& arguments, bool redirect_output) {
+    auto argv = std::vector<char*>();
+    for (auto& argument : arguments)
+      argv.push_back(argument.data());
+    argv.push_back(nullptr);
+
+    auto file_actions = posix_spawn_file_actions_t{ };
+    ::posix_spawn_file_actions_init(&file_actions);
+    ::posix_spawn_file_actions_addopen(&file_actions,
+      STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    if (redirect_output) {
+      ::posix_spawn_file_actions_addopen(&file_actions,
+        STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+      ::posix_spawn_file_actions_adddup2(&file_actions,
+        STDOUT_FILENO, STDERR_FILENO);
+    }
+
+    // do not inherit blocked signals
+    auto attributes = posix_spawnattr_t{ };
+    ::posix_spawnattr_init(&attributes);
+    auto signal_mask = sigset_t{ };
+    sigemptyset(&signal_mask);
+    ::posix_spawnattr_setsigmask(&attributes, &signal_mask);
+    ::posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
+    auto pid = pid_t{ };
+    const auto result = ::posix_spawnp(&pid, argv[0],
+      &file_actions, &attributes, argv.data(), environ);
+    ::posix_spawnattr_destroy(&attributes);
+    ::posix_spawn_file_actions_destroy(&file_actions);
+    return (result == 0);
+  }
+} // namespace
+
+ActionLauncher::~ActionLauncher() {
+  if (m_child_exited_fds[0] >= 0) {
+    ::signal(SIGCHLD, SIG_DFL);
+    g_child_exited_fd = -1;
+    ::close(m_child_exited_fds[0]);
+    ::close(m_child_exited_fds[1]);
+  }
+}
+
+bool ActionLauncher::initialize() {
+  if (::pipe2(m_child_exited_fds, O_NONBLOCK | O_CLOEXEC) != 0)
+    return false;
+  g_child_exited_fd = m_child_exited_fds[1];
+
+  struct sigaction action{ };
+  action.sa_handler = &catch_child;
+  action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigemptyset(&action.sa_mask);
+  return (::sigaction(SIGCHLD, &action, nullptr) == 0);
+}
+
+bool ActionLauncher::execute(const std::string& command, bool redirect_output) {
+  // fall back to shell, also when command was not found, it might be a builtin
+  auto arguments = std::vector<std::string>();
+  if (split_simple_command(command, &arguments) &&
+      spawn(arguments, redirect_output))
+    return true;
+
+  arguments = { "/bin/sh", "-c", command };
+  return spawn(arguments, redirect_output);
+}
+
+void ActionLauncher::reap_children() {
+  // signals might have been coalesced, so reap until there are none left
+  char buffer[64];
+  auto signaled = false;
+  while (::read(m_child_exited_fds[0], buffer, sizeof(buffer)) > 0)
+    signaled = true;
+  if (!signaled)
+    return;
+
+  auto status = 0;
+  while (::waitpid(-1, &status, WNOHANG) > 0)
+    ;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+// starts terminal commands using posix_spawn, commands which do not
+// require shell features are executed directly
+class ActionLauncher {
+public:
+  ActionLauncher() = default;
+  ActionLauncher(const ActionLauncher&) = delete;
+  ActionLauncher& operator=(const ActionLauncher&) = delete;
+  ~ActionLauncher();
+
+  bool initialize();
+  // descriptor which becomes readable when a child exited
+  int child_exited_fd() const { return m_child_exited_fds[0]; }
+  bool execute(const std::string& command, bool redirect_output);
+  void reap_children();
+
+private:
+  int m_child_exited_fds[2]{ -1, -1 };
+};
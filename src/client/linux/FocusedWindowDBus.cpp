@@ -71,10 +71,20 @@ public:
   }
 
   bool update() override {
-    dbus_connection_read_write_dispatch(m_connection, 0);
+    // dispatch all buffered messages, descriptor does not signal them
+    dbus_connection_read_write(m_connection, 0);
+    while (dbus_connection_dispatch(m_connection) == DBUS_DISPATCH_DATA_REMAINS)
+      ;
     return std::exchange(m_updated, false);
   }
 
+  int poll_fd() const override {
+    auto fd = -1;
+    if (!dbus_connection_get_unix_fd(m_connection, &fd))
+      return -1;
+    return fd;
+  }
+
 private:
   static DBusHandlerResult server_message_handler(
       DBusConnection* connection, DBusMessage* message, void* user_data) {
@@ -41,6 +41,18 @@ bool FocusedWindowImpl::update() {
   return false;
 }
 
+bool FocusedWindowImpl::get_poll_fds(std::vector<int>* fds) const {
+  auto all_pollable = true;
+  for (const auto& system : m_systems) {
+    const auto fd = system->poll_fd();
+    if (fd >= 0)
+      fds->push_back(fd);
+    else
+      all_pollable = false;
+  }
+  return all_pollable;
+}
+
 //-------------------------------------------------------------------------
 
 FocusedWindow::FocusedWindow()
@@ -62,6 +74,10 @@ bool FocusedWindow::update() {
   return m_impl->update();
 }
 
+bool FocusedWindow::get_poll_fds(std::vector<int>* fds) const {
+  return m_impl->get_poll_fds(fds);
+}
+
 const std::string& FocusedWindow::window_class() const {
   return m_impl->window_class;
 }
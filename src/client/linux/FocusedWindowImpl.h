@@ -13,6 +13,8 @@ class FocusedWindowSystem {
 public:
   virtual ~FocusedWindowSystem() = default;
   virtual bool update() = 0;
+  // descriptor which becomes readable on changes, -1 when it has to be polled
+  virtual int poll_fd() const { return -1; }
 };
 
 class FocusedWindowImpl : public FocusedWindowData {
@@ -23,4 +25,5 @@ public:
   bool initialize();
   void shutdown();
   bool update();
+  bool get_poll_fds(std::vector<int>* fds) const;
 };
@@ -7,6 +7,7 @@
 # include <X11/Xatom.h>
 # include <X11/Xutil.h>
 # include <X11/Xos.h>
+# include <utility>
 
 class FocusedWindowX11 : public FocusedWindowSystem {
 private:
@@ -17,6 +18,8 @@ private:
   Atom m_net_wm_name_atom{ };
   Atom m_utf8_string_atom{ };
   Window m_focused_window{ };
+  Window m_data_window{ };
+  bool m_update_pending{ true };
 
 public:
   explicit FocusedWindowX11(FocusedWindowData* data)
@@ -41,13 +44,57 @@ public:
     m_net_wm_name_atom = XInternAtom(m_display, "_NET_WM_NAME", False);
     m_utf8_string_atom = XInternAtom(m_display, "UTF8_STRING", False);
     XSetErrorHandler([](Display*, XErrorEvent*) { return 0; });
+
+    // get notified when active window changes
+    XSelectInput(m_display, m_root_window, PropertyChangeMask);
+    XFlush(m_display);
     return true;
   }
 
   bool update() override {
+    // events can also be queued during the requests
+    auto updated = false;
+    while (read_property_events())
+      updated |= update_focused_window();
+    XFlush(m_display);
+    return updated;
+  }
+
+  int poll_fd() const override {
+    return ConnectionNumber(m_display);
+  }
+
+private:
+  bool read_property_events() {
+    auto changed = std::exchange(m_update_pending, false);
+    while (XPending(m_display)) {
+      auto event = XEvent{ };
+      XNextEvent(m_display, &event);
+      if (event.type != PropertyNotify)
+        continue;
+      const auto& property = event.xproperty;
+      if ((property.window == m_root_window &&
+           property.atom == m_net_active_window_atom) ||
+          (property.window == m_focused_window &&
+           property.atom == m_net_wm_name_atom))
+        changed = true;
+    }
+    return changed;
+  }
+
+  bool update_focused_window() {
     const auto window = get_focused_window();
+    if (window != m_focused_window) {
+      // get notified when title of focused window changes
+      if (m_focused_window)
+        XSelectInput(m_display, m_focused_window, NoEventMask);
+      if (window)
+        XSelectInput(m_display, window, PropertyChangeMask);
+      m_focused_window = window;
+    }
+
     auto window_title = get_window_title(window);
-    if (window == m_focused_window &&
+    if (window == m_data_window &&
         window_title == m_data.window_title)
       return false;
 
@@ -56,13 +103,12 @@ public:
     if (window_class.empty() || window_title.empty())
       return false;
 
-    m_focused_window = window;
+    m_data_window = window;
     m_data.window_class = std::move(window_class);
     m_data.window_title = std::move(window_title);
     return true;
   }
 
-private:
   Window get_focused_window() {
     auto type = Atom{ };
     auto format = 0;
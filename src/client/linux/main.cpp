@@ -3,57 +3,60 @@
 #include "client/ServerPort.h"
 #include "client/Settings.h"
 #include "client/ConfigFile.h"
+#include "client/linux/ActionLauncher.h"
 #include "config/Config.h"
+#include "config/ContextMatcher.h"
 #include "common/output.h"
-#include <csignal>
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/wait.h>
+#include <poll.h>
 #include <pwd.h>
 
 namespace {
   const auto system_config_path = std::filesystem::path("/etc/");
+  // only used when a change cannot be waited for
   const auto update_interval = std::chrono::milliseconds(50);
 
   Settings g_settings;
   ServerPort g_server;
   ConfigFile g_config_file;
   FocusedWindow g_focused_window;
+  ContextMatcher g_context_matcher;
+  ActionLauncher g_action_launcher;
   std::vector<int> g_active_contexts;
 
-  void catch_child([[maybe_unused]] int sig_num) {
-    auto child_status = 0;
-    ::wait(&child_status);
-  }
-
-  void execute_terminal_command(const std::string& command) {
+  void execute_terminal_command(const std::string& command,
+      Clock::time_point triggered_time) {
     verbose("Executing terminal command '%s'", command.c_str());
-    if (fork() == 0) {
-      dup2(open("/dev/null", O_RDONLY), STDIN_FILENO);
-      if (!g_verbose_output) {
-        dup2(open("/dev/null", O_RDWR), STDOUT_FILENO);
-        dup2(open("/dev/null", O_RDWR), STDERR_FILENO);
-      }
-      execl("/bin/sh", "sh", "-c", command.c_str(), nullptr);
-      exit(1);
+    if (!g_action_launcher.execute(command, !g_verbose_output)) {
+      error("Executing terminal command failed");
+      return;
     }
+    // spawning returns after the child was executed
+    verbose("Executed after %.2fms", std::chrono::duration<double, std::milli>(
+      Clock::now() - triggered_time).count());
   }
 
-  bool send_active_contexts() {
-    g_active_contexts.clear();
-    const auto& contexts = g_config_file.config().contexts;
-    const auto& window_class = g_focused_window.window_class();
-    const auto& window_title = g_focused_window.window_title();
-    for (auto i = 0; i < static_cast<int>(contexts.size()); ++i)
-      if (contexts[i].matches(window_class, window_title))
-        g_active_contexts.push_back(i);
+  bool send_active_contexts(bool force_send) {
+    const auto& active_contexts = g_context_matcher.match(
+      g_focused_window.window_class(), g_focused_window.window_title());
+    if (!force_send && active_contexts == g_active_contexts)
+      return true;
 
+    g_active_contexts = active_contexts;
+    verbose("Active contexts updated (%u, %d cache hits)",
+      g_active_contexts.size(), g_context_matcher.cache_hits());
     return g_server.send_active_contexts(g_active_contexts);
   }
 
+  void update_context_matcher() {
+    g_context_matcher.set_contexts(&g_config_file.config().contexts);
+  }
+
   bool receive_triggered_action() {
     auto triggered_action = -1;
-    if (!g_server.receive_triggered_action(update_interval, &triggered_action))
+    auto triggered_time = Clock::time_point();
+    if (!g_server.receive_triggered_action(Duration::zero(),
+        &triggered_action, &triggered_time))
       return false;
 
     const auto& actions = g_config_file.config().actions;
@@ -63,18 +66,51 @@ namespace {
     if (triggered_action >= static_cast<int>(actions.size()))
       return false;
 
-    execute_terminal_command(actions[triggered_action].terminal_command);
+    execute_terminal_command(actions[triggered_action].terminal_command,
+      triggered_time);
     return true;
   }
 
-  void main_loop() {
+  // blocks until any of the sources has something to process
+  bool wait_for_events() {
+    auto fds = std::vector<int>{ g_server.socket(),
+      g_action_launcher.child_exited_fd() };
+    auto can_wait = g_focused_window.get_poll_fds(&fds);
+    if (g_settings.auto_update_config) {
+      if (g_config_file.watch_fd() >= 0)
+        fds.push_back(g_config_file.watch_fd());
+      else
+        can_wait = false;
+      if (g_config_file.parsed_fd() >= 0)
+        fds.push_back(g_config_file.parsed_fd());
+    }
 
+    auto poll_fds = std::vector<pollfd>();
+    for (auto fd : fds)
+      poll_fds.push_back({ fd, POLLIN, 0 });
+    const auto timeout = (can_wait ? -1 : static_cast<int>(
+      std::chrono::milliseconds(update_interval).count()));
+    const auto result = ::poll(poll_fds.data(), poll_fds.size(), timeout);
+    return (result >= 0 || errno == EINTR);
+  }
+
+  void main_loop() {
     for (;;) {
-      // update configuration
+      // update configuration, which is parsed in background
       auto configuration_updated = false;
-      if (g_settings.auto_update_config &&
-          g_config_file.update()) {
+      if (g_settings.auto_update_config)
+        g_config_file.update_async();
+      if (g_config_file.get_parsed_config()) {
         message("Configuration updated");
+        update_context_matcher();
+        if (!g_server.send_config(g_config_file.config()))
+          return;
+        configuration_updated = true;
+      }
+
+      // resend complete configuration when requested
+      if (g_server.config_requested()) {
+        verbose("Resending configuration");
         if (!g_server.send_config(g_config_file.config()))
           return;
         configuration_updated = true;
@@ -85,12 +121,17 @@ namespace {
         verbose("Detected focused window changed:");
         verbose("  class = '%s'", g_focused_window.window_class().c_str());
         verbose("  title = '%s'", g_focused_window.window_title().c_str());
-        if (!send_active_contexts())
+        if (!send_active_contexts(configuration_updated))
           return;
       }
 
       if (!receive_triggered_action())
         return;
+
+      g_action_launcher.reap_children();
+
+      if (!wait_for_events())
+        return;
     }
   }
 
@@ -104,7 +145,7 @@ namespace {
 
       verbose("Sending configuration");
       if (!g_server.send_config(g_config_file.config()) ||
-          !send_active_contexts()) {
+          !send_active_contexts(true)) {
         error("Sending configuration failed");
         return 1;
       }
@@ -164,13 +205,18 @@ int main(int argc, char* argv[]) {
   g_settings.config_file_path = 
     resolve_config_file_path(std::move(g_settings.config_file_path));
 
-  ::signal(SIGCHLD, &catch_child);
+  if (!g_action_launcher.initialize()) {
+    error("Initializing action launcher failed");
+    return 1;
+  }
 
   verbose("Loading configuration file '%s'", g_settings.config_file_path.c_str());
   if (!g_config_file.load(g_settings.config_file_path))
     return 1;
+  update_context_matcher();
 
   if (g_settings.check_config) {
+    g_config_file.report_optimizations();
     message("The configuration is valid");
     return 0;
   }
@@ -2,6 +2,7 @@
 #include "client/FocusedWindow.h"
 #include "client/Settings.h"
 #include "client/ConfigFile.h"
+#include "config/ContextMatcher.h"
 #include "client/ServerPort.h"
 #include "common/windows/LimitSingleInstance.h"
 #include "common/output.h"
@@ -38,6 +39,7 @@ namespace {
   ConfigFile g_config_file;
   ServerPort g_server;
   FocusedWindow g_focused_window;
+  ContextMatcher g_context_matcher;
   std::vector<int> g_new_active_contexts;
   std::vector<int> g_current_active_contexts;
   bool g_was_inaccessible;
@@ -102,17 +104,14 @@ namespace {
   }
  
   void update_active_contexts(bool force_send) {
-    const auto& contexts = g_config_file.config().contexts;
-
     g_new_active_contexts.clear();
     if (g_active)
-      for (auto i = 0; i < static_cast<int>(contexts.size()); ++i)
-        if (contexts[i].matches(g_focused_window.window_class(),
-            g_focused_window.window_title()))
-          g_new_active_contexts.push_back(i);
+      g_new_active_contexts = g_context_matcher.match(
+        g_focused_window.window_class(), g_focused_window.window_title());
 
     if (force_send || g_new_active_contexts != g_current_active_contexts) {
-      verbose("Active contexts updated (%u)", g_new_active_contexts.size());
+      verbose("Active contexts updated (%u, %d cache hits)",
+        g_new_active_contexts.size(), g_context_matcher.cache_hits());
       g_server.send_active_contexts(g_new_active_contexts);
       g_current_active_contexts.swap(g_new_active_contexts);
     }
@@ -144,6 +143,7 @@ namespace {
   }
 
   bool send_config() {
+    g_context_matcher.set_contexts(&g_config_file.config().contexts);
     if (!g_server.send_config(g_config_file.config())) {
       error("Sending configuration failed");
       return false;
@@ -170,6 +170,14 @@ namespace {
     }    
   }
 
+  void update_config_async() {
+    g_config_file.update_async();
+    if (g_config_file.get_parsed_config()) {
+      message("Configuration updated");
+      send_config();
+    }
+  }
+
   void open_configuration() {
     const auto filename = g_config_file.filename().wstring();
 
@@ -253,6 +261,10 @@ namespace {
           auto triggered_action = -1;
           g_server.receive_triggered_action(Duration::zero(), &triggered_action);
           execute_action(triggered_action);
+          if (g_server.config_requested()) {
+            verbose("Resending configuration");
+            send_config();
+          }
         }
         else {
           verbose("Connection to keymapperd lost");
@@ -296,7 +308,7 @@ namespace {
           validate_state();
         }
         else if (wparam == TIMER_UPDATE_CONFIG) {
-          update_config();
+          update_config_async();
         }
         else if (wparam == TIMER_CREATE_TRAY_ICON) {
           // workaround: re/create tray icon after taskbar was created
@@ -363,6 +375,7 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE, LPWSTR, int) {
   if (g_settings.check_config) {
     if (!g_config_file.load(g_settings.config_file_path))
       return 1;
+    g_config_file.report_optimizations();
     message("The configuration is valid");
     return 0;
   }
@@ -0,0 +1,176 @@
+
+#include "write_config.h"
+#include "config/Config.h"
+#include <unordered_map>
+
+namespace {
+  const auto new_context = int32_t{ -1 };
+
+  uint64_t hash_bytes(const void* data, size_t size,
+      uint64_t hash = 14695981039346656037ull) {
+    // FNV-1a
+    for (auto i = size_t{ }; i < size; ++i) {
+      hash ^= static_cast<const unsigned char*>(data)[i];
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  template<typename T>
+  uint64_t hash_value(const T& value, uint64_t hash) {
+    return hash_bytes(&value, sizeof(value), hash);
+  }
+
+  uint64_t hash_key_sequence(const KeySequence& sequence, uint64_t hash) {
+    hash = hash_value(static_cast<uint32_t>(sequence.size()), hash);
+    return hash_bytes(sequence.data(), sequence.size() * sizeof(KeyEvent), hash);
+  }
+
+  // identifies the contents of contexts which were not hashed by the parser
+  uint64_t hash_context(const Config::Context& context) {
+    auto hash = hash_bytes(nullptr, 0);
+    for (const auto& input : context.inputs) {
+      hash = hash_key_sequence(input.input, hash);
+      hash = hash_value(input.output_index, hash);
+    }
+    hash = hash_value(static_cast<uint32_t>(context.inputs.size()), hash);
+    for (const auto& output : context.outputs)
+      hash = hash_key_sequence(output, hash);
+    hash = hash_value(static_cast<uint32_t>(context.outputs.size()), hash);
+    for (const auto& command : context.command_outputs) {
+      hash = hash_key_sequence(command.output, hash);
+      hash = hash_value(command.index, hash);
+    }
+    hash = hash_value(static_cast<uint32_t>(context.command_outputs.size()), hash);
+    return hash_bytes(context.device_filter.data(),
+      context.device_filter.size(), hash);
+  }
+
+  // identical key sequences of the written contexts are written once
+  class KeySequencePool {
+  public:
+    uint32_t add(const KeySequence& sequence) {
+      const auto [it, inserted] = m_indices.emplace(&sequence,
+        static_cast<uint32_t>(m_sequences.size()));
+      if (inserted)
+        m_sequences.push_back(&sequence);
+      return it->second;
+    }
+    const std::vector<const KeySequence*>& sequences() const {
+      return m_sequences;
+    }
+
+  private:
+    struct Hash {
+      size_t operator()(const KeySequence* sequence) const {
+        return KeySequenceHash()(*sequence);
+      }
+    };
+    struct Equal {
+      bool operator()(const KeySequence* a, const KeySequence* b) const {
+        return (*a == *b);
+      }
+    };
+    std::unordered_map<const KeySequence*, uint32_t, Hash, Equal> m_indices;
+    std::vector<const KeySequence*> m_sequences;
+  };
+
+  // key events are transferred in their memory representation
+  static_assert(sizeof(KeyEvent) == sizeof(Key) + sizeof(KeyEvent::data));
+
+  size_t get_key_sequence_size(const KeySequence& sequence) {
+    return sizeof(uint32_t) + sequence.size() * sizeof(KeyEvent);
+  }
+
+  // upper bound, since identical key sequences are written once
+  size_t get_context_size(const Config::Context& context) {
+    auto size = 4 * sizeof(uint32_t);
+    for (const auto& input : context.inputs)
+      size += get_key_sequence_size(input.input) + 2 * sizeof(int32_t);
+    for (const auto& output : context.outputs)
+      size += get_key_sequence_size(output) + sizeof(uint32_t);
+    for (const auto& command : context.command_outputs)
+      size += get_key_sequence_size(command.output) + 2 * sizeof(int32_t);
+    return size + context.device_filter.size();
+  }
+
+  void write_key_sequence(Serializer& s, const KeySequence& sequence) {
+    s.write_array(sequence);
+  }
+
+  // key sequences are written as indices into the pool
+  void write_context(Serializer& s, const Config::Context& context,
+      KeySequencePool& pool) {
+    // inputs
+    s.write(static_cast<uint32_t>(context.inputs.size()));
+    for (const auto& input : context.inputs) {
+      s.write(pool.add(input.input));
+      s.write(static_cast<int32_t>(input.output_index));
+    }
+
+    // outputs
+    s.write(static_cast<uint32_t>(context.outputs.size()));
+    for (const auto& output : context.outputs)
+      s.write(pool.add(output));
+
+    // command outputs
+    s.write(static_cast<uint32_t>(context.command_outputs.size()));
+    for (const auto& command : context.command_outputs) {
+      s.write(pool.add(command.output));
+      s.write(static_cast<int32_t>(command.index));
+    }
+
+    // device filter
+    s.write(static_cast<uint32_t>(context.device_filter.size()));
+    s.write(context.device_filter.data(), context.device_filter.size());
+  }
+} // namespace
+
+int write_config(Serializer& s, const Config& config,
+    uint32_t base_version, uint32_t version,
+    const std::vector<uint64_t>& base_context_hashes,
+    std::vector<uint64_t>* context_hashes) {
+  // allocate buffer for complete configuration at once
+  auto size = 5 * sizeof(uint32_t);
+  for (const auto& context : config.contexts)
+    size += sizeof(int32_t) + get_context_size(context);
+  for (const auto& keys : config.logical_keys)
+    size += sizeof(uint32_t) + keys.size() * sizeof(Key);
+  s.reserve(size);
+
+  s.write(base_version);
+  s.write(version);
+  s.write(static_cast<uint32_t>(config.contexts.size()));
+
+  auto base_context_indices = std::unordered_map<uint64_t, int32_t>();
+  for (auto i = 0u; i < base_context_hashes.size(); ++i)
+    base_context_indices.emplace(base_context_hashes[i],
+      static_cast<int32_t>(i));
+
+  auto changed = 0;
+  auto pool = KeySequencePool();
+  context_hashes->clear();
+  for (const auto& context : config.contexts) {
+    const auto hash = (context.hash ? context.hash : hash_context(context));
+    context_hashes->push_back(hash);
+    const auto it = base_context_indices.find(hash);
+    if (it != base_context_indices.end()) {
+      s.write(it->second);
+      continue;
+    }
+    s.write(new_context);
+    write_context(s, context, pool);
+    ++changed;
+  }
+
+  // key sequences of the written contexts
+  s.write(static_cast<uint32_t>(pool.sequences().size()));
+  for (const auto& sequence : pool.sequences())
+    write_key_sequence(s, *sequence);
+
+  // logical keys
+  s.write(static_cast<uint32_t>(config.logical_keys.size()));
+  for (const auto& keys : config.logical_keys)
+    s.write_array(keys);
+  return changed;
+}
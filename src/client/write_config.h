@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "common/Connection.h"
+
+struct Config;
+
+// contexts, which are unchanged since the base version, are only
+// referenced by their index in the base version.
+// returns the number of contexts which were written completely
+int write_config(Serializer& s, const Config& config,
+  uint32_t base_version, uint32_t version,
+  const std::vector<uint64_t>& base_context_hashes,
+  std::vector<uint64_t>* context_hashes);
@@ -1,5 +1,7 @@
 
 #include "Connection.h"
+#include <algorithm>
+#include <array>
 #include <thread>
 
 const auto ipc_id = "keymapper";
@@ -48,6 +50,7 @@ void set_unix_domain_socket_path(sockaddr_un& addr, bool unlink) {
 #include <sys/un.h>
 #include <sys/stat.h>
 #include <cerrno>
+#include <cstring>
 
 Connection::Connection() = default;
 
@@ -72,6 +75,8 @@ timeval to_timeval(const Duration& duration) {
 }
 
 Connection::~Connection() {
+  close_received_fds();
+  clear_send_queue();
   if (m_socket_fd != invalid_socket)
     ::close(m_socket_fd);
 
@@ -146,7 +151,23 @@ void Connection::disconnect() {
     ::close(m_socket_fd);
     m_socket_fd = invalid_socket;
   }
-  m_deserializer.buffer.clear();
+  m_receive_begin = m_receive_end = 0;
+  close_received_fds();
+  clear_send_queue();
+}
+
+auto Connection::take_received_fd() -> Socket {
+  if (m_received_fds.empty())
+    return invalid_socket;
+  const auto fd = m_received_fds.front();
+  m_received_fds.erase(m_received_fds.begin());
+  return fd;
+}
+
+void Connection::close_received_fds() {
+  for (auto fd : m_received_fds)
+    ::close(fd);
+  m_received_fds.clear();
 }
 
 bool Connection::wait_for_message(std::optional<Duration> timeout) {
@@ -163,25 +184,209 @@ bool Connection::wait_for_message(std::optional<Duration> timeout) {
   }
 }
 
-bool Connection::send(const char* buffer, size_t length) {
-  while (length != 0) {
-    const auto result = ::send(m_socket_fd, buffer,
-      static_cast<int>(length), 0);
-    if (result == -1 && (errno == EINTR || errno == EWOULDBLOCK))
-      continue;
-    if (result <= 0)
+namespace {
+  // limit of bytes queued when peer does not read
+  const auto max_send_queue_size = size_t{ 256 * 1024 };
+} // namespace
+
+bool Connection::send_serialized(Socket fd, SendPolicy policy) {
+  const auto& buffer = m_serializer.buffer;
+  const auto size = static_cast<Size>(buffer.size());
+  const auto header = reinterpret_cast<const char*>(&size);
+  const auto total = sizeof(Size) + buffer.size();
+
+  if (policy == SendPolicy::coalesce && coalesce_queued(buffer))
+    return send_queued(false);
+
+  // try to send directly, header and payload at once
+  auto sent = size_t{ };
+  if (!send_queued(false))
+    return false;
+  if (m_send_queue.empty()) {
+    const auto result = send(header, sizeof(Size),
+      buffer.data(), buffer.size(), fd);
+    if (result < 0)
       return false;
-    length -= static_cast<size_t>(result);
-    buffer += result;
+    sent = static_cast<size_t>(result);
+    if (sent == total)
+      return true;
+  }
+
+  if (policy == SendPolicy::drop && sent == 0 &&
+      m_send_queue_size + total > max_send_queue_size)
+    return true;
+
+  enqueue(header, sizeof(Size), buffer.data(), buffer.size(), sent, fd);
+  return send_queued(policy == SendPolicy::block);
+}
+
+void Connection::enqueue(const char* header, size_t header_size,
+    const char* data, size_t size, size_t sent, Socket fd) {
+  auto message = OutboundMessage{ };
+  message.data.resize(header_size + size);
+  std::memcpy(message.data.data(), header, header_size);
+  std::memcpy(message.data.data() + header_size, data, size);
+  message.sent = sent;
+  message.fd = invalid_socket;
+#if !defined(_WIN32)
+  // keep own reference until file descriptor was sent
+  if (sent == 0 && fd != invalid_socket)
+    message.fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+#endif
+  m_send_queue_size += message.data.size() - sent;
+  m_send_queue.push_back(std::move(message));
+}
+
+bool Connection::coalesce_queued(const std::vector<char>& message) {
+  // replace unsent message starting with the same type,
+  // it is moved to the end to keep the order of the other messages
+  if (message.empty())
+    return false;
+  for (auto it = m_send_queue.begin(); it != m_send_queue.end(); ++it)
+    if (it->sent == 0 && it->fd == invalid_socket &&
+        it->data.size() > sizeof(Size) && 
+        it->data[sizeof(Size)] == message.front()) {
+      auto queued = std::move(*it);
+      m_send_queue.erase(it);
+      m_send_queue_size -= queued.data.size();
+      const auto size = static_cast<Size>(message.size());
+      queued.data.resize(sizeof(Size) + message.size());
+      std::memcpy(queued.data.data(), &size, sizeof(Size));
+      std::memcpy(queued.data.data() + sizeof(Size), 
+        message.data(), message.size());
+      m_send_queue_size += queued.data.size();
+      m_send_queue.push_back(std::move(queued));
+      return true;
+    }
+  return false;
+}
+
+bool Connection::flush_send_queue() {
+  return send_queued(false);
+}
+
+bool Connection::send_queued(bool wait) {
+  while (!m_send_queue.empty()) {
+    auto& message = m_send_queue.front();
+    const auto result = send(message.data.data() + message.sent,
+      message.data.size() - message.sent, nullptr, 0, message.fd);
+    if (result < 0)
+      return false;
+
+    if (result == 0) {
+      if (!wait)
+        return true;
+      if (!wait_until_writable())
+        return false;
+      continue;
+    }
+
+    if (message.fd != invalid_socket) {
+      ::close(message.fd);
+      message.fd = invalid_socket;
+    }
+    message.sent += static_cast<size_t>(result);
+    m_send_queue_size -= static_cast<size_t>(result);
+    if (message.sent == message.data.size())
+      m_send_queue.pop_front();
   }
   return true;
 }
 
+bool Connection::wait_until_writable() {
+  auto write_set = fd_set{ };
+  for (;;) {
+    FD_ZERO(&write_set);
+    FD_SET(m_socket_fd, &write_set);
+    const auto result = ::select(static_cast<int>(m_socket_fd) + 1,
+      nullptr, &write_set, nullptr, nullptr);
+    if (result == -1 && errno == EINTR)
+      continue;
+    return (result > 0);
+  }
+}
+
+void Connection::clear_send_queue() {
+  for (const auto& message : m_send_queue)
+    if (message.fd != invalid_socket)
+      ::close(message.fd);
+  m_send_queue.clear();
+  m_send_queue_size = 0;
+}
+
+// returns number of bytes sent or 0 when it would block
+int Connection::send(const char* header, size_t header_size,
+    const char* data, size_t size, Socket fd) {
+#if !defined(_WIN32)
+  auto iov = std::array<iovec, 2>{
+    iovec{ const_cast<char*>(header), header_size },
+    iovec{ const_cast<char*>(data), size },
+  };
+  auto message = msghdr{ };
+  message.msg_iov = iov.data();
+  message.msg_iovlen = (size ? 2 : 1);
+
+  // pass file descriptor as ancillary data along with the first byte
+  auto control = std::array<char, CMSG_SPACE(sizeof(int))>{ };
+  if (fd != invalid_socket) {
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+    auto cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  for (;;) {
+    const auto result = ::sendmsg(m_socket_fd, &message, MSG_NOSIGNAL);
+    if (result == -1 && errno == EINTR)
+      continue;
+    if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+    return (result > 0 ? static_cast<int>(result) : -1);
+  }
+#else
+  auto buffers = std::array<WSABUF, 2>{
+    WSABUF{ static_cast<ULONG>(header_size), const_cast<char*>(header) },
+    WSABUF{ static_cast<ULONG>(size), const_cast<char*>(data) },
+  };
+  auto sent = DWORD{ };
+  if (::WSASend(m_socket_fd, buffers.data(), (size ? 2 : 1),
+        &sent, 0, nullptr, nullptr) != 0)
+    return (WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1);
+  return static_cast<int>(sent);
+#endif
+}
+
 int Connection::recv(char* buffer, size_t length) {
   auto read = 0;
   while (length != 0) {
+#if !defined(_WIN32)
+    // also receive passed file descriptors
+    auto iov = iovec{ buffer, length };
+    auto control = std::array<char, CMSG_SPACE(sizeof(int) * 4)>{ };
+    auto message = msghdr{ };
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+    const auto result = ::recvmsg(m_socket_fd, &message, MSG_CMSG_CLOEXEC);
+    if (result > 0)
+      for (auto cmsg = CMSG_FIRSTHDR(&message); cmsg;
+           cmsg = CMSG_NXTHDR(&message, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+          const auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+          for (auto i = size_t{ }; i < count; ++i) {
+            auto fd = int{ };
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            m_received_fds.push_back(fd);
+          }
+        }
+#else
     const auto result = ::recv(m_socket_fd, buffer,
       static_cast<int>(length), 0);
+#endif
 #if defined(_WIN32)
     if (result == -1 && WSAGetLastError() == WSAEWOULDBLOCK)
       break;
@@ -200,19 +405,37 @@ int Connection::recv(char* buffer, size_t length) {
   return read;
 }
 
-bool Connection::recv(std::vector<char>& buffer) {
-  const auto buffer_grow_size = 1024;
-  auto pos = buffer.size();
-  for (;;) {
-    if (pos == buffer.size())
-      buffer.resize(buffer.size() + buffer_grow_size);
-    const auto result = recv(buffer.data() + pos, buffer.size() - pos);
-    if (result < 0)
-      return false;
-    if (result == 0)
-      break;
-    pos += static_cast<size_t>(result);
+// returns -1 on error, 0 when it would block and 1 when buffer is full
+int Connection::receive() {
+  const auto min_free_size = size_t{ 4096 };
+  auto& buffer = m_receive_buffer;
+  const auto pending = m_receive_end - m_receive_begin;
+
+  // make room for the complete message once its size is known
+  auto required = pending + min_free_size;
+  if (pending >= sizeof(Size)) {
+    auto size = Size{ };
+    std::memcpy(&size, buffer.data() + m_receive_begin, sizeof(Size));
+    required = std::max(required, sizeof(Size) + size);
   }
-  buffer.resize(pos);
-  return true;
+  if (m_receive_begin + required > buffer.size()) {
+    if (required <= buffer.size()) {
+      // move the beginning of the message to the front
+      std::memmove(buffer.data(), buffer.data() + m_receive_begin, pending);
+    }
+    else {
+      auto resized = std::vector<char>(required);
+      std::memcpy(resized.data(), buffer.data() + m_receive_begin, pending);
+      buffer.swap(resized);
+    }
+    m_receive_begin = 0;
+    m_receive_end = pending;
+  }
+
+  const auto free_size = buffer.size() - m_receive_end;
+  const auto result = recv(buffer.data() + m_receive_end, free_size);
+  if (result < 0)
+    return -1;
+  m_receive_end += static_cast<size_t>(result);
+  return (static_cast<size_t>(result) == free_size ? 1 : 0);
 }
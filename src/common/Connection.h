@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <cstring>
 #include <vector>
+#include <deque>
+#include <memory>
 #include <optional>
 #include <type_traits>
 #include "Duration.h"
@@ -20,6 +22,18 @@ public:
     write(&value, sizeof(T));
   }
 
+  // writes element count followed by all elements at once
+  template<typename T, typename = std::enable_if_t<std::is_trivially_copyable_v<T>>>
+  void write_array(const std::vector<T>& array) {
+    write(static_cast<uint32_t>(array.size()));
+    write(array.data(), array.size() * sizeof(T));
+  }
+
+  const char* data() const { return buffer.data(); }
+  size_t size() const { return buffer.size(); }
+  void reserve(size_t additional) { buffer.reserve(buffer.size() + additional); }
+  void clear() { buffer.clear(); }
+
 private:
   friend class Connection;
   std::vector<char> buffer;
@@ -27,9 +41,24 @@ private:
 
 class Deserializer {
 public:
+  Deserializer() = default;
+  explicit Deserializer(std::vector<char> data)
+    : buffer(std::move(data)), 
+      it(buffer.data()), 
+      end(buffer.data() + buffer.size()) {
+  }
+  // reads from external memory, which is kept alive by owner
+  Deserializer(std::shared_ptr<const void> owner, const char* data, size_t size)
+    : owner(std::move(owner)), it(data), end(data + size) {
+  }
+  Deserializer(const Deserializer&) = delete;
+  Deserializer& operator=(const Deserializer&) = delete;
+  Deserializer(Deserializer&&) = default;
+  Deserializer& operator=(Deserializer&&) = default;
+
   void read(void* data, size_t size) {
     if (can_read(size)) {
-      std::memcpy(data, &*it, size);
+      std::memcpy(data, it, size);
       it += size;
     }
   }
@@ -46,14 +75,35 @@ public:
     read(data, sizeof(T));
   }
 
+  template<typename T, typename = std::enable_if_t<std::is_trivially_copyable_v<T>>>
+  void read_array(std::vector<T>* array) {
+    const auto count = read<uint32_t>();
+    if (!can_read(count * sizeof(T))) {
+      array->clear();
+      return;
+    }
+    array->resize(count);
+    read(array->data(), count * sizeof(T));
+  }
+
   bool can_read(size_t length) const { 
     return (length > 0 && 
-            it - buffer.begin() + length <= buffer.size()); 
+            static_cast<size_t>(end - it) >= length); 
   }
+
+  // moves the rest of the current message to a new deserializer
+  Deserializer detach_remaining() {
+    auto remaining = Deserializer(std::vector<char>(it, end));
+    it = end;
+    return remaining;
+  }
+
 private:
   friend class Connection;
   std::vector<char> buffer;
-  std::vector<char>::iterator it;
+  std::shared_ptr<const void> owner;
+  const char* it{ };
+  const char* end{ };
 };
 
 class Connection {
@@ -78,19 +128,39 @@ public:
   bool connect();
   void disconnect();
 
+  enum class SendPolicy {
+    // wait until message and all queued messages are sent
+    block,
+    // drop message when peer does not read and send queue is full
+    drop,
+    // replace a queued message of the same type
+    coalesce,
+  };
+
+  template<typename F> // void(Serializer&)
+  bool send_message(F&& write_message,
+      SendPolicy policy = SendPolicy::block) {
+    return send_message_with_fd(invalid_socket,
+      std::forward<F>(write_message), policy);
+  }
+
+  // passes a file descriptor along with the message (not on Windows)
   template<typename F> // void(Serializer&)
-  bool send_message(F&& write_message) {
+  bool send_message_with_fd(Socket fd, F&& write_message,
+      SendPolicy policy = SendPolicy::block) {
     // serialize messages to buffer
-    auto& buffer = m_serializer.buffer;
-    buffer.clear();
+    m_serializer.buffer.clear();
     write_message(m_serializer);
-
-    // send message size and buffer
-    auto size = static_cast<Size>(buffer.size());
-    return send(reinterpret_cast<char*>(&size), sizeof(size)) &&
-           send(buffer.data(), buffer.size());
+    return send_serialized(fd, policy);
   }
 
+  // sends queued messages as far as possible without blocking
+  bool flush_send_queue();
+  bool has_pending_send() const { return !m_send_queue.empty(); }
+
+  // returns file descriptors passed along with the messages in order
+  Socket take_received_fd();
+
   template<typename F> // void(Deserializer&)
   bool read_messages(std::optional<Duration> timeout, F&& deserialize) {
     // block until message can be read or timeout
@@ -98,37 +168,70 @@ public:
         !wait_for_message(timeout))
       return false;
 
-    // read into buffer until it would block
-    auto& buffer = m_deserializer.buffer;
-    if (!recv(buffer))
-      return false;
+    for (;;) {
+      // read into buffer until it would block or buffer is full
+      const auto result = receive();
+      if (result < 0)
+        return false;
 
-    // deserialize complete messages
-    m_deserializer.it = buffer.begin();
-    while (m_deserializer.can_read(sizeof(Size))) {
-      const auto size = m_deserializer.read<Size>();
-      if (!m_deserializer.can_read(size)) {
-        m_deserializer.it -= sizeof(Size);
-        break;
+      // deserialize complete messages in place
+      const auto data = m_receive_buffer.data();
+      const auto data_end = data + m_receive_end;
+      m_deserializer.it = data + m_receive_begin;
+      m_deserializer.end = data_end;
+      while (m_deserializer.can_read(sizeof(Size))) {
+        const auto size = m_deserializer.read<Size>();
+        if (!m_deserializer.can_read(size)) {
+          m_deserializer.it -= sizeof(Size);
+          break;
+        }
+        // do not let deserialization read beyond message
+        const auto end = m_deserializer.it + size;
+        m_deserializer.end = end;
+        deserialize(m_deserializer);
+        if (m_deserializer.it != end)
+          return false;
+        m_deserializer.end = data_end;
       }
-      const auto end = m_deserializer.it + size;
-      deserialize(m_deserializer);
-      if (m_deserializer.it != end)
-        return false;
+      m_receive_begin = static_cast<size_t>(m_deserializer.it - data);
+      if (m_receive_begin == m_receive_end)
+        m_receive_begin = m_receive_end = 0;
+
+      if (result == 0)
+        return true;
     }
-    buffer.erase(buffer.begin(), m_deserializer.it);
-    return true;
   }
 
 private:
   void make_non_blocking();
   bool wait_for_message(std::optional<Duration> timeout);
-  bool send(const char* buffer, size_t length);
+  struct OutboundMessage {
+    std::vector<char> data;
+    size_t sent;
+    Socket fd;
+  };
+
+  bool send_serialized(Socket fd, SendPolicy policy);
+  void enqueue(const char* header, size_t header_size,
+    const char* data, size_t size, size_t sent, Socket fd);
+  bool coalesce_queued(const std::vector<char>& message);
+  bool send_queued(bool wait);
+  bool wait_until_writable();
+  int send(const char* header, size_t header_size,
+    const char* data, size_t size, Socket fd);
+  void clear_send_queue();
   int recv(char* buffer, size_t length);
-  bool recv(std::vector<char>& buffer);
+  int receive();
+  void close_received_fds();
 
   Socket m_socket_fd{ ~Socket() };
   Socket m_listen_fd{ ~Socket() };
   Serializer m_serializer;
   Deserializer m_deserializer;
+  std::vector<char> m_receive_buffer;
+  size_t m_receive_begin{ };
+  size_t m_receive_end{ };
+  std::vector<Socket> m_received_fds;
+  std::deque<OutboundMessage> m_send_queue;
+  size_t m_send_queue_size{ };
 };
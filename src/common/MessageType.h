@@ -6,4 +6,12 @@ enum class MessageType : uint8_t {
   configuration = 1,
   active_contexts,
   validate_state,
+  triggered_action,
+  configuration_request,
+};
+
+// how configuration data follows the message type
+enum class ConfigTransfer : uint8_t {
+  message = 1,
+  memfd,
 };
@@ -0,0 +1,489 @@
+
+#include "Regex.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace {
+  const auto max_dfa_states = size_t{ 2048 };
+  const auto max_repetitions = 1000;
+
+  // thrown for valid syntax, which is not supported by the DFA
+  struct Unsupported { };
+
+  using ByteSet = std::bitset<256>;
+
+  ByteSet make_set(const char* chars) {
+    auto set = ByteSet();
+    for (; *chars; ++chars)
+      set.set(static_cast<unsigned char>(*chars));
+    return set;
+  }
+
+  ByteSet make_range(int first, int last) {
+    auto set = ByteSet();
+    for (auto c = first; c <= last; ++c)
+      set.set(static_cast<size_t>(c));
+    return set;
+  }
+
+  const auto digit_set = make_range('0', '9');
+  const auto word_set = make_range('a', 'z') | make_range('A', 'Z') |
+    make_range('0', '9') | make_set("_");
+  const auto space_set = make_set(" \t\n\v\f\r");
+  const auto line_terminator_set = make_set("\n\r");
+
+  void add_other_case(ByteSet& set) {
+    for (auto c = 'a'; c <= 'z'; ++c) {
+      const auto upper = static_cast<char>(std::toupper(c));
+      if (set.test(static_cast<size_t>(c)) ||
+          set.test(static_cast<size_t>(upper))) {
+        set.set(static_cast<size_t>(c));
+        set.set(static_cast<size_t>(upper));
+      }
+    }
+  }
+
+  int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    throw Unsupported{ };
+  }
+} // namespace
+
+struct RegexSet::Node {
+  enum class Type { Set, Concat, Alternate, Repeat, Begin, End };
+  Type type;
+  ByteSet set;
+  std::vector<Node> children;
+  int min;
+  int max;
+};
+
+class RegexSet::Parser {
+public:
+  Parser(std::string_view pattern, bool icase)
+    : m_it(pattern.begin()), m_end(pattern.end()), m_icase(icase) {
+  }
+
+  Node parse() {
+    auto node = parse_alternation();
+    if (m_it != m_end)
+      throw Unsupported{ };
+    return node;
+  }
+
+private:
+  bool at_end() const { return m_it == m_end; }
+  char peek() const { return (at_end() ? '\0' : *m_it); }
+
+  bool skip(char c) {
+    if (at_end() || *m_it != c)
+      return false;
+    ++m_it;
+    return true;
+  }
+
+  char read() {
+    if (at_end())
+      throw Unsupported{ };
+    return *m_it++;
+  }
+
+  Node make_node(ByteSet set) const {
+    if (m_icase)
+      add_other_case(set);
+    return { Node::Type::Set, set, { }, 0, 0 };
+  }
+
+  Node parse_alternation() {
+    auto node = Node{ Node::Type::Alternate, { }, { }, 0, 0 };
+    node.children.push_back(parse_concatenation());
+    while (skip('|'))
+      node.children.push_back(parse_concatenation());
+    if (node.children.size() == 1)
+      return std::move(node.children.front());
+    return node;
+  }
+
+  Node parse_concatenation() {
+    auto node = Node{ Node::Type::Concat, { }, { }, 0, 0 };
+    while (!at_end() && peek() != '|' && peek() != ')')
+      node.children.push_back(parse_quantified());
+    return node;
+  }
+
+  Node parse_quantified() {
+    auto atom = parse_atom();
+    auto min = 0;
+    auto max = -1;
+    if (skip('*')) {
+    }
+    else if (skip('+')) {
+      min = 1;
+    }
+    else if (skip('?')) {
+      max = 1;
+    }
+    else if (skip('{')) {
+      min = read_number();
+      max = min;
+      if (skip(','))
+        max = (peek() == '}' ? -1 : read_number());
+      if (!skip('}') || (max >= 0 && max < min))
+        throw Unsupported{ };
+    }
+    else {
+      return atom;
+    }
+    // lazy quantifiers do not change whether there is a match
+    skip('?');
+
+    if (atom.type == Node::Type::Begin || atom.type == Node::Type::End ||
+        (!at_end() && std::strchr("*+?{", peek())))
+      throw Unsupported{ };
+    return { Node::Type::Repeat, { }, { std::move(atom) }, min, max };
+  }
+
+  int read_number() {
+    auto value = 0;
+    if (!std::isdigit(static_cast<unsigned char>(peek())))
+      throw Unsupported{ };
+    while (std::isdigit(static_cast<unsigned char>(peek()))) {
+      value = value * 10 + (read() - '0');
+      if (value > max_repetitions)
+        throw Unsupported{ };
+    }
+    return value;
+  }
+
+  Node parse_atom() {
+    const auto c = read();
+    switch (c) {
+      case '(': {
+        // only non-capturing groups, no lookahead
+        if (skip('?') && !skip(':'))
+          throw Unsupported{ };
+        auto node = parse_alternation();
+        if (!skip(')'))
+          throw Unsupported{ };
+        return node;
+      }
+      case '[':
+        return parse_class();
+      case '.':
+        return { Node::Type::Set, ~line_terminator_set, { }, 0, 0 };
+      case '^':
+        return { Node::Type::Begin, { }, { }, 0, 0 };
+      case '$':
+        return { Node::Type::End, { }, { }, 0, 0 };
+      case '\\':
+        return make_node(parse_escape(false));
+      case ')': case ']': case '{': case '}':
+      case '*': case '+': case '?': case '|':
+        throw Unsupported{ };
+    }
+    return make_node(ByteSet().set(static_cast<unsigned char>(c)));
+  }
+
+  ByteSet parse_escape(bool in_class) {
+    const auto c = read();
+    switch (c) {
+      case 'd': return digit_set;
+      case 'D': return ~digit_set;
+      case 'w': return word_set;
+      case 'W': return ~word_set;
+      case 's': return space_set;
+      case 'S': return ~space_set;
+      case 't': return ::make_set("\t");
+      case 'n': return ::make_set("\n");
+      case 'r': return ::make_set("\r");
+      case 'f': return ::make_set("\f");
+      case 'v': return ::make_set("\v");
+      case 'x': {
+        const auto high = hex_value(read());
+        const auto low = hex_value(read());
+        return ByteSet().set(static_cast<size_t>(high * 16 + low));
+      }
+      case '0':
+        if (std::isdigit(static_cast<unsigned char>(peek())))
+          throw Unsupported{ };
+        return ByteSet().set(0);
+      case 'b':
+        // backspace in class, word boundary otherwise
+        if (!in_class)
+          throw Unsupported{ };
+        return ::make_set("\b");
+    }
+    // no back references, unicode or control escapes
+    if (std::isalnum(static_cast<unsigned char>(c)))
+      throw Unsupported{ };
+    return ByteSet().set(static_cast<unsigned char>(c));
+  }
+
+  // returns single character or -1 for a class escape like \d
+  int parse_class_atom(ByteSet& set) {
+    const auto c = read();
+    if (c == '\\') {
+      const auto escaped = parse_escape(true);
+      set |= escaped;
+      if (escaped.count() != 1)
+        return -1;
+      for (auto i = 0; i < 256; ++i)
+        if (escaped.test(static_cast<size_t>(i)))
+          return i;
+    }
+    // no POSIX classes or collating elements
+    if (c == '[' && !at_end() && std::strchr(":.=", peek()))
+      throw Unsupported{ };
+    set.set(static_cast<unsigned char>(c));
+    return static_cast<unsigned char>(c);
+  }
+
+  Node parse_class() {
+    const auto negate = skip('^');
+    auto set = ByteSet();
+    while (!skip(']')) {
+      const auto first = parse_class_atom(set);
+      if (peek() == '-' && m_it + 1 != m_end && *(m_it + 1) != ']') {
+        ++m_it;
+        const auto last = parse_class_atom(set);
+        if (first < 0 || last < 0 || last < first)
+          throw Unsupported{ };
+        set |= make_range(first, last);
+      }
+    }
+    if (m_icase)
+      add_other_case(set);
+    if (negate)
+      set = ~set;
+    return { Node::Type::Set, set, { }, 0, 0 };
+  }
+
+  std::string_view::const_iterator m_it;
+  const std::string_view::const_iterator m_end;
+  const bool m_icase;
+};
+
+//-------------------------------------------------------------------------
+
+int RegexSet::add_state(Type type, int out, int out2) {
+  m_nfa.push_back({ type, out, out2 });
+  return static_cast<int>(m_nfa.size()) - 1;
+}
+
+// builds NFA for node, continuing with state next
+int RegexSet::compile(const Node& node, int next) {
+  switch (node.type) {
+    case Node::Type::Set:
+      m_sets.push_back(node.set);
+      return add_state(Type::Set, next, static_cast<int>(m_sets.size()) - 1);
+
+    case Node::Type::Concat:
+      for (auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+        next = compile(*it, next);
+      return next;
+
+    case Node::Type::Alternate: {
+      auto state = compile(node.children.back(), next);
+      for (auto i = static_cast<int>(node.children.size()) - 2; i >= 0; --i)
+        state = add_state(Type::Split, compile(node.children[i], next), state);
+      return state;
+    }
+
+    case Node::Type::Repeat: {
+      const auto& child = node.children.front();
+      auto state = next;
+      if (node.max < 0) {
+        // loop back to split after child
+        state = add_state(Type::Split, -1, next);
+        m_nfa[state].out = compile(child, state);
+      }
+      else {
+        for (auto i = node.min; i < node.max; ++i)
+          state = add_state(Type::Split, compile(child, state), next);
+      }
+      for (auto i = 0; i < node.min; ++i)
+        state = compile(child, state);
+      return state;
+    }
+
+    case Node::Type::Begin:
+      return add_state(Type::Begin, next);
+
+    case Node::Type::End:
+      return add_state(Type::End, next);
+  }
+  return next;
+}
+
+int RegexSet::add(std::string_view pattern, bool icase) {
+  const auto index = m_pattern_count++;
+  try {
+    const auto node = Parser(pattern, icase).parse();
+    const auto nfa_size = m_nfa.size();
+    const auto sets_size = m_sets.size();
+    try {
+      const auto match = add_state(Type::Match, index);
+      m_starts.push_back(compile(node, match));
+    }
+    catch (...) {
+      m_nfa.resize(nfa_size);
+      m_sets.resize(sets_size);
+      throw;
+    }
+    m_dfa.clear();
+    m_dfa_indices.clear();
+  }
+  catch (const Unsupported&) {
+    auto type = std::regex::ECMAScript;
+    if (icase)
+      type |= std::regex::icase;
+    m_fallbacks.emplace_back(index,
+      std::regex(pattern.data(), pattern.size(), type));
+  }
+  return index;
+}
+
+// follows epsilon transitions, ^ only at the beginning and $ only at the end
+std::vector<int> RegexSet::closure(std::vector<int> seeds,
+    bool at_begin, bool at_end) const {
+  auto visited = std::vector<bool>(m_nfa.size());
+  auto result = std::vector<int>();
+  while (!seeds.empty()) {
+    const auto index = seeds.back();
+    seeds.pop_back();
+    if (visited[index])
+      continue;
+    visited[index] = true;
+
+    const auto& state = m_nfa[index];
+    switch (state.type) {
+      case Type::Split:
+        seeds.push_back(state.out2);
+        seeds.push_back(state.out);
+        break;
+      case Type::Begin:
+        if (at_begin)
+          seeds.push_back(state.out);
+        break;
+      case Type::End:
+        if (at_end)
+          seeds.push_back(state.out);
+        else
+          result.push_back(index);
+        break;
+      case Type::Set:
+      case Type::Match:
+        result.push_back(index);
+        break;
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+int RegexSet::get_dfa_state(std::vector<int> seeds, bool at_begin) const {
+  auto nfa_states = closure(std::move(seeds), at_begin, false);
+  if (!at_begin)
+    if (auto it = m_dfa_indices.find(nfa_states); it != m_dfa_indices.end())
+      return it->second;
+
+  // start again when DFA is getting too big
+  if (m_dfa.size() >= max_dfa_states) {
+    m_dfa.clear();
+    m_dfa_indices.clear();
+    ++m_dfa_generation;
+    get_dfa_state(m_starts, true);
+  }
+
+  auto state = DfaState{ };
+  for (auto index : nfa_states)
+    if (m_nfa[index].type == Type::Match)
+      state.matches.push_back(m_nfa[index].out);
+  for (auto index : closure(nfa_states, at_begin, true))
+    if (m_nfa[index].type == Type::Match)
+      state.end_matches.push_back(m_nfa[index].out);
+  state.next.fill(-1);
+  state.nfa_states = std::move(nfa_states);
+
+  const auto index = static_cast<int>(m_dfa.size());
+  // the start state is always the first, it is not looked up
+  if (!at_begin)
+    m_dfa_indices.emplace(state.nfa_states, index);
+  m_dfa.push_back(std::move(state));
+  return index;
+}
+
+int RegexSet::get_next_dfa_state(int index, unsigned char c) const {
+  if (const auto next = m_dfa[index].next[c]; next >= 0)
+    return next;
+
+  // patterns can also start at each following position
+  auto seeds = m_starts;
+  for (auto nfa_index : m_dfa[index].nfa_states) {
+    const auto& state = m_nfa[nfa_index];
+    if (state.type == Type::Set && m_sets[state.out2].test(c))
+      seeds.push_back(state.out);
+  }
+
+  const auto generation = m_dfa_generation;
+  const auto next = get_dfa_state(std::move(seeds), false);
+  if (generation == m_dfa_generation)
+    m_dfa[index].next[c] = next;
+  return next;
+}
+
+template<typename F>
+void RegexSet::run_dfa(std::string_view text, F&& matched) const {
+  if (m_starts.empty())
+    return;
+  if (m_dfa.empty())
+    get_dfa_state(m_starts, true);
+
+  auto state = 0;
+  if (matched(m_dfa[state].matches))
+    return;
+  for (auto c : text) {
+    state = get_next_dfa_state(state, static_cast<unsigned char>(c));
+    if (matched(m_dfa[state].matches))
+      return;
+  }
+  matched(m_dfa[state].end_matches);
+}
+
+void RegexSet::search(std::string_view text, std::vector<int>* matches) const {
+  matches->clear();
+  run_dfa(text, [&](const std::vector<int>& patterns) {
+    matches->insert(matches->end(), patterns.begin(), patterns.end());
+    return false;
+  });
+  for (const auto& [index, regex] : m_fallbacks)
+    if (std::regex_search(text.begin(), text.end(), regex))
+      matches->push_back(index);
+
+  std::sort(matches->begin(), matches->end());
+  matches->erase(std::unique(matches->begin(), matches->end()), matches->end());
+}
+
+bool RegexSet::search_any(std::string_view text) const {
+  auto found = false;
+  run_dfa(text, [&](const std::vector<int>& patterns) {
+    found = !patterns.empty();
+    return found;
+  });
+  if (found)
+    return true;
+  for (const auto& [index, regex] : m_fallbacks)
+    if (std::regex_search(text.begin(), text.end(), regex))
+      return true;
+  return false;
+}
+
+//-------------------------------------------------------------------------
+
+Regex::Regex(std::string_view pattern, bool icase)
+  : m_pattern(pattern), m_icase(icase) {
+  m_set.add(pattern, icase);
+}
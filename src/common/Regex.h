@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <map>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// searches for multiple regular expressions in a single pass,
+// the supported subset of the ECMAScript syntax is matched by a lazily
+// built DFA, others fall back to std::regex.
+// not thread safe, since the DFA is built while searching.
+class RegexSet {
+public:
+  // returns index of pattern, throws std::regex_error when it is invalid
+  int add(std::string_view pattern, bool icase);
+  int size() const { return m_pattern_count; }
+
+  // fills indices of all patterns found in text
+  void search(std::string_view text, std::vector<int>* matches) const;
+  bool search_any(std::string_view text) const;
+
+private:
+  enum class Type : uint8_t { Set, Split, Begin, End, Match };
+
+  // out2 is the index of the set for Set states,
+  // out is the index of the pattern for Match states
+  struct NfaState {
+    Type type;
+    int out;
+    int out2;
+  };
+
+  struct DfaState {
+    std::vector<int> nfa_states;
+    std::vector<int> matches;
+    std::vector<int> end_matches;
+    std::array<int, 256> next;
+  };
+
+  struct Node;
+  class Parser;
+
+  int compile(const Node& node, int next);
+  int add_state(Type type, int out, int out2 = -1);
+  std::vector<int> closure(std::vector<int> seeds,
+    bool at_begin, bool at_end) const;
+  int get_dfa_state(std::vector<int> nfa_states, bool at_begin) const;
+  int get_next_dfa_state(int state, unsigned char c) const;
+  template<typename F> // bool(const std::vector<int>& matches)
+  void run_dfa(std::string_view text, F&& matched) const;
+
+  int m_pattern_count{ };
+  std::vector<NfaState> m_nfa;
+  // sets of bytes matched by Set states and patterns of Match states
+  std::vector<std::bitset<256>> m_sets;
+  std::vector<int> m_starts;
+  std::vector<std::pair<int, std::regex>> m_fallbacks;
+
+  mutable std::vector<DfaState> m_dfa;
+  mutable std::map<std::vector<int>, int> m_dfa_indices;
+  mutable int m_dfa_generation{ };
+};
+
+class Regex {
+public:
+  Regex(std::string_view pattern, bool icase);
+
+  bool search(std::string_view text) const { return m_set.search_any(text); }
+  const std::string& pattern() const { return m_pattern; }
+  bool icase() const { return m_icase; }
+
+private:
+  RegexSet m_set;
+  std::string m_pattern;
+  bool m_icase;
+};
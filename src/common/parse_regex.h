@@ -1,6 +1,6 @@
 #pragma once
 
-#include <regex>
+#include "Regex.h"
 #include <string>
 #include <cassert>
 
@@ -10,14 +10,12 @@ inline bool is_regex(std::string_view string) {
           string[string.size() - (string.back() == 'i' ? 2 : 1)] == '/');
 }
 
-inline std::regex parse_regex(std::string_view string) {
+inline Regex parse_regex(std::string_view string) {
   assert(is_regex(string));
   string.remove_prefix(1);
-  auto type = std::regex::ECMAScript;
-  if (string.back() == 'i') {
+  const auto icase = (string.back() == 'i');
+  if (icase)
     string.remove_suffix(1);
-    type |= std::regex::icase;
-  }
   string.remove_suffix(1);
-  return std::regex(string.data(), string.size(), type);
+  return Regex(string, icase);
 }
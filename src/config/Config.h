@@ -3,7 +3,7 @@
 #include "runtime/KeyEvent.h"
 #include <string>
 #include <optional>
-#include <regex>
+#include "common/Regex.h"
 
 struct Config {
   struct Input {
@@ -19,13 +19,13 @@ struct Config {
 
   struct Filter {
     std::string string;
-    std::optional<std::regex> regex;
+    std::optional<Regex> regex;
 
     bool matches(const std::string& text, bool substring) const {
       if (string.empty())
         return true;
       if (regex.has_value())
-        return std::regex_search(text, *regex);
+        return regex->search(text);
       return (substring ?
         text.find(string) != std::string::npos :
         text == string);
@@ -40,6 +40,8 @@ struct Config {
     std::vector<Input> inputs;
     std::vector<KeySequence> outputs;
     std::vector<CommandOutput> command_outputs;
+    // identifies the parsed contents, to detect unchanged contexts
+    uint64_t hash{ };
 
     bool matches(const std::string& window_class,
                  const std::string& window_title) const {
@@ -57,4 +59,5 @@ struct Config {
 
   std::vector<Context> contexts;
   std::vector<Action> actions;
+  LogicalKeys logical_keys;
 };
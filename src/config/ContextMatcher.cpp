@@ -0,0 +1,212 @@
+
+#include "ContextMatcher.h"
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <utility>
+
+namespace {
+  const auto max_cache_entries = size_t{ 32 };
+
+  size_t hash_window(const std::string& window_class,
+                     const std::string& window_title) {
+    const auto hash = std::hash<std::string>();
+    return hash(window_class) ^ (hash(window_title) * 31);
+  }
+} // namespace
+
+int ContextMatcher::SubstringMatcher::add_pattern(std::string_view pattern) {
+  if (m_nodes.empty())
+    m_nodes.push_back({ { }, 0, -1, -1 });
+
+  auto node = 0;
+  for (auto c : pattern) {
+    auto& next = m_nodes[node].next;
+    const auto it = std::find_if(next.begin(), next.end(),
+      [&](const auto& edge) { return edge.first == c; });
+    if (it != next.end()) {
+      node = it->second;
+    }
+    else {
+      const auto index = static_cast<int>(m_nodes.size());
+      next.emplace_back(c, index);
+      m_nodes.push_back({ { }, 0, -1, -1 });
+      node = index;
+    }
+  }
+  if (m_nodes[node].pattern < 0)
+    m_nodes[node].pattern = m_pattern_count++;
+  return m_nodes[node].pattern;
+}
+
+int ContextMatcher::SubstringMatcher::get_next(int node, char c) const {
+  for (;;) {
+    const auto& next = m_nodes[node].next;
+    const auto it = std::find_if(next.begin(), next.end(),
+      [&](const auto& edge) { return edge.first == c; });
+    if (it != next.end())
+      return it->second;
+    if (node == 0)
+      return 0;
+    node = m_nodes[node].fail;
+  }
+}
+
+void ContextMatcher::SubstringMatcher::build() {
+  // set failure links breadth first
+  auto queue = std::deque<int>();
+  if (!m_nodes.empty())
+    for (const auto& [c, child] : m_nodes[0].next)
+      queue.push_back(child);
+
+  while (!queue.empty()) {
+    const auto node = queue.front();
+    queue.pop_front();
+    for (const auto& [c, child] : m_nodes[node].next) {
+      const auto fail = get_next(m_nodes[node].fail, c);
+      m_nodes[child].fail = fail;
+      m_nodes[child].output_link = (m_nodes[fail].pattern >= 0 ?
+        fail : m_nodes[fail].output_link);
+      queue.push_back(child);
+    }
+  }
+}
+
+template<typename F>
+void ContextMatcher::SubstringMatcher::find(std::string_view text, F&& match) const {
+  if (m_nodes.empty())
+    return;
+  auto node = 0;
+  for (auto c : text) {
+    node = get_next(node, c);
+    for (auto output = (m_nodes[node].pattern >= 0 ? node :
+           m_nodes[node].output_link); output >= 0;
+         output = m_nodes[output].output_link)
+      match(m_nodes[output].pattern);
+  }
+}
+
+//-------------------------------------------------------------------------
+
+void ContextMatcher::set_contexts(const std::vector<Config::Context>* contexts) {
+  m_contexts = contexts;
+  m_cache.clear();
+  m_filter_counts.clear();
+  m_class_contexts.clear();
+  m_title_matcher = { };
+  m_title_contexts.clear();
+  m_class_regexes = { };
+  m_class_regex_contexts.clear();
+  m_title_regexes = { };
+  m_title_regex_contexts.clear();
+  if (!contexts)
+    return;
+
+  // regular expressions are merged into one automaton per text
+  auto class_regex_indices = std::unordered_map<std::string, int>();
+  auto title_regex_indices = std::unordered_map<std::string, int>();
+  const auto add_regex = [](const Config::Filter& filter, RegexSet& regexes,
+      std::unordered_map<std::string, int>& indices,
+      std::vector<std::vector<int>>& regex_contexts) -> std::vector<int>& {
+    const auto [it, inserted] = indices.emplace(filter.string, regexes.size());
+    if (inserted) {
+      regexes.add(filter.regex->pattern(), filter.regex->icase());
+      regex_contexts.emplace_back();
+    }
+    return regex_contexts[it->second];
+  };
+
+  for (auto i = 0; i < static_cast<int>(contexts->size()); ++i) {
+    const auto& context = (*contexts)[i];
+    auto& filter_count = m_filter_counts.emplace_back();
+
+    if (const auto& filter = context.window_class_filter; !filter.string.empty()) {
+      if (filter.regex.has_value())
+        add_regex(filter, m_class_regexes, class_regex_indices,
+          m_class_regex_contexts).push_back(i);
+      else
+        m_class_contexts[filter.string].push_back(i);
+      ++filter_count;
+    }
+
+    if (const auto& filter = context.window_title_filter; !filter.string.empty()) {
+      if (filter.regex.has_value()) {
+        add_regex(filter, m_title_regexes, title_regex_indices,
+          m_title_regex_contexts).push_back(i);
+      }
+      else {
+        const auto pattern = m_title_matcher.add_pattern(filter.string);
+        if (pattern >= static_cast<int>(m_title_contexts.size()))
+          m_title_contexts.resize(pattern + 1);
+        m_title_contexts[pattern].push_back(i);
+      }
+      ++filter_count;
+    }
+  }
+  m_title_matcher.build();
+}
+
+void ContextMatcher::match_contexts(const std::string& window_class,
+    const std::string& window_title, std::vector<int>* context_indices) {
+  // count matching filters of each context
+  auto& matched = m_matched_filters;
+  matched.assign(m_filter_counts.size(), 0);
+
+  if (auto it = m_class_contexts.find(window_class); it != m_class_contexts.end())
+    for (auto index : it->second)
+      ++matched[index];
+
+  // each pattern counts once, even when found multiple times
+  m_matched_titles.assign(m_title_contexts.size(), false);
+  m_title_matcher.find(window_title, [&](int pattern) {
+    if (!std::exchange(m_matched_titles[pattern], true))
+      for (auto index : m_title_contexts[pattern])
+        ++matched[index];
+  });
+
+  m_class_regexes.search(window_class, &m_matched_regexes);
+  for (auto regex : m_matched_regexes)
+    for (auto index : m_class_regex_contexts[regex])
+      ++matched[index];
+
+  m_title_regexes.search(window_title, &m_matched_regexes);
+  for (auto regex : m_matched_regexes)
+    for (auto index : m_title_regex_contexts[regex])
+      ++matched[index];
+
+  context_indices->clear();
+  for (auto i = 0; i < static_cast<int>(matched.size()); ++i)
+    if (matched[i] == m_filter_counts[i])
+      context_indices->push_back(i);
+}
+
+const std::vector<int>& ContextMatcher::match(
+    const std::string& window_class, const std::string& window_title) {
+  const auto hash = hash_window(window_class, window_title);
+  auto it = std::find_if(m_cache.begin(), m_cache.end(),
+    [&](const Entry& entry) {
+      return (entry.hash == hash &&
+              entry.window_class == window_class &&
+              entry.window_title == window_title);
+    });
+  if (it != m_cache.end()) {
+    ++m_cache_hits;
+    it->last_used = ++m_use_counter;
+    return it->context_indices;
+  }
+
+  // replace least recently used entry
+  if (m_cache.size() < max_cache_entries) {
+    it = m_cache.emplace(m_cache.end());
+  }
+  else {
+    it = std::min_element(m_cache.begin(), m_cache.end(),
+      [](const Entry& a, const Entry& b) { return a.last_used < b.last_used; });
+  }
+  it->hash = hash;
+  it->window_class = window_class;
+  it->window_title = window_title;
+  it->last_used = ++m_use_counter;
+  match_contexts(window_class, window_title, &it->context_indices);
+  return it->context_indices;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Config.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+// finds the contexts matching a window class and title,
+// remembering the results of the recently focused windows
+class ContextMatcher {
+public:
+  void set_contexts(const std::vector<Config::Context>* contexts);
+  const std::vector<int>& match(const std::string& window_class,
+                                const std::string& window_title);
+  int cache_hits() const { return m_cache_hits; }
+
+private:
+  // Aho-Corasick automaton finding all patterns in a text in one pass
+  class SubstringMatcher {
+  public:
+    int add_pattern(std::string_view pattern);
+    void build();
+    template<typename F> // void(int pattern)
+    void find(std::string_view text, F&& match) const;
+
+  private:
+    struct Node {
+      std::vector<std::pair<char, int>> next;
+      int fail;
+      int pattern;
+      int output_link;
+    };
+    int get_next(int node, char c) const;
+
+    std::vector<Node> m_nodes;
+    int m_pattern_count{ };
+  };
+
+  struct Entry {
+    size_t hash;
+    std::string window_class;
+    std::string window_title;
+    std::vector<int> context_indices;
+    int last_used;
+  };
+
+  void match_contexts(const std::string& window_class,
+    const std::string& window_title, std::vector<int>* context_indices);
+
+  const std::vector<Config::Context>* m_contexts{ };
+  // number of filters each context has
+  std::vector<int> m_filter_counts;
+  std::unordered_map<std::string, std::vector<int>> m_class_contexts;
+  SubstringMatcher m_title_matcher;
+  std::vector<std::vector<int>> m_title_contexts;
+  RegexSet m_class_regexes;
+  std::vector<std::vector<int>> m_class_regex_contexts;
+  RegexSet m_title_regexes;
+  std::vector<std::vector<int>> m_title_regex_contexts;
+  std::vector<int> m_matched_filters;
+  std::vector<int> m_matched_regexes;
+  std::vector<char> m_matched_titles;
+
+  std::vector<Entry> m_cache;
+  int m_use_counter{ };
+  int m_cache_hits{ };
+};
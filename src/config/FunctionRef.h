@@ -0,0 +1,44 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+// non-owning reference to a callable, which must outlive it
+template<typename Signature>
+class FunctionRef;
+
+template<typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+public:
+  FunctionRef() = default;
+
+  template<typename F, typename = std::enable_if_t<
+    !std::is_same_v<std::decay_t<F>, FunctionRef> &&
+    !std::is_function_v<std::remove_pointer_t<std::decay_t<F>>> &&
+    std::is_invocable_r_v<R, F&, Args...>>>
+  FunctionRef(F&& function)
+    : m_object(const_cast<void*>(static_cast<const void*>(&function))),
+      m_invoke([](void* object, Args... args) -> R {
+        return (*static_cast<std::remove_reference_t<F>*>(object))(
+          std::forward<Args>(args)...);
+      }) {
+  }
+
+  FunctionRef(R (*function)(Args...))
+    : m_object(reinterpret_cast<void*>(function)),
+      m_invoke([](void* object, Args... args) -> R {
+        return reinterpret_cast<R (*)(Args...)>(object)(
+          std::forward<Args>(args)...);
+      }) {
+  }
+
+  explicit operator bool() const { return (m_invoke != nullptr); }
+
+  R operator()(Args... args) const {
+    return m_invoke(m_object, std::forward<Args>(args)...);
+  }
+
+private:
+  void* m_object{ };
+  R (*m_invoke)(void*, Args...){ };
+};
@@ -5,13 +5,16 @@
 #include "common/parse_regex.h"
 #include <cassert>
 #include <cctype>
+#include <fstream>
 #include <istream>
 #include <algorithm>
+#include <atomic>
+#include <exception>
 #include <iterator>
+#include <thread>
+#include <type_traits>
 
 namespace {
-  using namespace std::placeholders;
-
 #if defined(__linux)
   const auto current_system = "linux";
 #elif defined(_WIN32)
@@ -20,65 +23,174 @@ namespace {
 #  error unknown system
 #endif
 
-  std::string to_lower(std::string str) {
+  const auto fnv_offset_basis = uint64_t{ 14695981039346656037ull };
+
+  uint64_t hash_append(uint64_t hash, const void* data, size_t size) {
+    // FNV-1a
+    for (auto i = size_t{ }; i < size; ++i) {
+      hash ^= static_cast<const unsigned char*>(data)[i];
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> ||
+    std::is_enum_v<T>>>
+  uint64_t hash_append(uint64_t hash, T value) {
+    return hash_append(hash, &value, sizeof(value));
+  }
+
+  uint64_t hash_append(uint64_t hash, std::string_view string) {
+    // prefixed with size to separate strings
+    hash = hash_append(hash, string.size());
+    return hash_append(hash, string.data(), string.size());
+  }
+
+  uint64_t hash_append(uint64_t hash, const KeySequence& sequence) {
+    hash = hash_append(hash, sequence.size());
+    return hash_append(hash, sequence.data(), sequence.size() * sizeof(KeyEvent));
+  }
+
+  const auto pending_sequences_per_chunk = size_t{ 256 };
+  const auto min_pending_sequences_per_thread = size_t{ 4096 };
+
+  // calls function for chunks of the range, distributed over the cores
+  template<typename F>
+  void parallel_for_chunks(size_t count, F&& function) {
+    const auto chunk_size = pending_sequences_per_chunk;
+    const auto chunks = (count + chunk_size - 1) / chunk_size;
+    const auto thread_count = std::min(
+      size_t{ std::max(std::thread::hardware_concurrency(), 1u) },
+      count / min_pending_sequences_per_thread + 1);
+
+    auto next_chunk = std::atomic<size_t>{ };
+    const auto process_chunks = [&]() {
+      for (auto chunk = next_chunk++; chunk < chunks; chunk = next_chunk++)
+        function(chunk, chunk * chunk_size,
+          std::min(count, (chunk + 1) * chunk_size));
+    };
+    auto threads = std::vector<std::thread>();
+    for (auto i = size_t{ 1 }; i < thread_count; ++i)
+      threads.emplace_back(process_chunks);
+    process_chunks();
+    for (auto& thread : threads)
+      thread.join();
+  }
+
+  std::string get_location(std::string_view filename, int line_no) {
+    auto location = " in line " + std::to_string(line_no);
+    if (!filename.empty())
+      location += " of '" + std::string(filename) + "'";
+    return location;
+  }
+
+  std::string to_lower(std::string_view view) {
+    auto str = std::string(view);
     for (auto& c : str)
       c = static_cast<char>(std::tolower(c));
     return str;
   }
 
-  bool contains(const KeySequence& sequence, Key key) {
-    return std::find_if(cbegin(sequence), cend(sequence),
-      [&](const KeyEvent& event) {
-        return event.key == key;
-      }) != cend(sequence);
-  }
-
-  void replace_key(KeySequence& sequence, Key both, Key key) {
-    std::for_each(begin(sequence), end(sequence),
-      [&](KeyEvent& event) {
-        if (event.key == both)
-          event.key = key;
-      });
+  const std::vector<Key>& get_logical_key_members(
+      const LogicalKeys& logical_keys, Key key) {
+    return logical_keys[static_cast<size_t>(*key - *Key::first_logical)];
   }
 
-  void replace_not_key(KeySequence& sequence, Key both, Key left,
-                       Key right) {
+  // replace !<logical> with !<member0> !<member1>...
+  void expand_not_logical_keys(KeySequence& sequence,
+                               const LogicalKeys& logical_keys) {
     for (auto it = begin(sequence); it != end(sequence); ++it)
-      if (it->state == KeyState::Not && it->key == both) {
-        it->key = right;
-        it = sequence.insert(it, { left, KeyState::Not });
-        ++it;
+      if (it->state == KeyState::Not && is_logical_key(it->key)) {
+        const auto& keys = get_logical_key_members(logical_keys, it->key);
+        it->key = keys.front();
+        for (auto i = 1u; i < keys.size(); ++i)
+          it = sequence.insert(std::next(it), { keys[i], KeyState::Not });
       }
   }
+
+  // the members of the logical keys an output contains are resolved
+  // into the output, so they identify its contents like the source
+  uint64_t hash_logical_keys(uint64_t hash, const KeySequence& sequence,
+                             const LogicalKeys& logical_keys) {
+    for (const auto& event : sequence)
+      if (is_logical_key(event.key))
+        for (auto key : get_logical_key_members(logical_keys, event.key))
+          hash = hash_append(hash, key);
+    return hash;
+  }
+
+  // replace <logical> with <member0>
+  void replace_logical_keys(KeySequence& sequence,
+                            const LogicalKeys& logical_keys) {
+    for (auto& event : sequence)
+      if (is_logical_key(event.key))
+        event.key = get_logical_key_members(logical_keys, event.key).front();
+  }
 } // namespace
 
 Config ParseConfig::operator()(std::istream& is) {
-  m_line_no = 0;
+  const auto contents = std::string(std::istreambuf_iterator<char>(is), { });
+  return (*this)(std::string_view(contents));
+}
+
+Config ParseConfig::operator()(std::string_view contents,
+    const std::filesystem::path& base_directory) {
+  m_filename = { };
+  m_directory = base_directory;
+  m_include_stack.clear();
   m_config = { };
   m_commands.clear();
+  m_command_indices.clear();
   m_macros.clear();
   m_logical_keys.clear();
-  m_context_modifier.clear();
+  m_logical_key_names.clear();
+  m_strings.clear();
+  m_pending_sequences.clear();
+  m_context_modifiers.clear();
+
+  // keep the files which were included by the last call
+  for (auto it = m_fragments.begin(); it != m_fragments.end(); )
+    if (!it->second.included) {
+      it = m_fragments.erase(it);
+    }
+    else {
+      it->second.included = false;
+      ++it;
+    }
 
   // add default context
   m_config.contexts.push_back({ true, {}, {} });
+  m_context_modifiers.emplace_back();
 
   // register common logical keys
   add_logical_key("Shift", Key::ShiftLeft, Key::ShiftRight);
   add_logical_key("Control", Key::ControlLeft, Key::ControlRight);
   add_logical_key("Meta", Key::MetaLeft, Key::MetaRight);
   
-  auto line = std::string();
-  while (is.good()) {
-    std::getline(is, line);
-    ++m_line_no;
-    parse_line(cbegin(line), cend(line));
+  // lines are split and preprocessed in source order, since each
+  // section can (re)define macros, logical keys and commands, which
+  // apply to all following lines. only parsing the key sequences is
+  // deferred and distributed over the cores
+  auto line_error = std::exception_ptr();
+  try {
+    parse_lines(contents);
+  }
+  catch (...) {
+    line_error = std::current_exception();
   }
 
+  // an error in a preceding key sequence is reported first
+  const auto source_hashes = reuse_parsed_sequences();
+  parse_pending_sequences();
+  if (line_error)
+    std::rethrow_exception(line_error);
+  store_parsed_sequences(source_hashes);
+  number_actions_and_hash_contexts(source_hashes);
+
   // check if there is a mapping for each command (to reduce typing errors)
   for (const auto& command : m_commands)
-    if (!command.mapped)
-      throw ParseError("Command '" + command.name + "' was not mapped");
+    if (command.mapped_context < 0)
+      throw ParseError("Command '" + std::string(command.name) + "' was not mapped");
 
   // remove contexts of other systems or which are empty
   m_config.contexts.erase(
@@ -89,17 +201,32 @@ Config ParseConfig::operator()(std::istream& is) {
       }),
     m_config.contexts.end());
 
-  // replace logical keys (in reverse order of registration)
-  for (auto it = m_logical_keys.rbegin(); it != m_logical_keys.rend(); ++it) {
-    const auto& [name, both, left, right] = *it;
-    replace_logical_key(both, left, right);
-  }
+  resolve_logical_keys();
   return std::move(m_config);
 }
 
+std::vector<std::filesystem::path> ParseConfig::included_files() const {
+  auto filenames = std::vector<std::filesystem::path>();
+  for (const auto& [filename, fragment] : m_fragments)
+    if (fragment.included)
+      filenames.emplace_back(filename);
+  return filenames;
+}
+
 void ParseConfig::error(std::string message) {
-  throw ParseError(std::move(message) +
-    " in line " + std::to_string(m_line_no));
+  throw ParseError(std::move(message) + get_location(m_filename, m_line_no));
+}
+
+void ParseConfig::parse_lines(std::string_view contents) {
+  m_line_no = 0;
+  for (auto it = contents.begin(); ; ++it) {
+    const auto line_end = std::find(it, contents.end(), '\n');
+    ++m_line_no;
+    parse_line(it, line_end);
+    it = line_end;
+    if (it == contents.end())
+      break;
+  }
 }
 
 void ParseConfig::parse_line(It it, It end) {
@@ -110,24 +237,27 @@ void ParseConfig::parse_line(It it, It end) {
   if (skip(&it, end, "[")) {
     parse_context(&it, end);
   }
+  else if (skip(&it, end, "@")) {
+    parse_directive(&it, end);
+  }
   else {
     const auto begin = it;
     skip_ident(&it, end);
-    auto first_ident = std::string(begin, it);
+    const auto first_ident_end = it;
+    const auto first_ident = to_string_view(begin, first_ident_end);
 
     skip_space(&it, end);
     if (skip(&it, end, "=")) {
       skip_space(&it, end);
       trim_comment(it, &end);
       if (!parse_logical_key_definition(first_ident, it, end))
-        parse_macro(std::move(first_ident), it, end);
+        parse_macro(first_ident, it, end);
     }
     else if (skip(&it, end, ">>")) {
       if (find_command(first_ident))
         parse_mapping(first_ident, it, end);
       else
-        parse_command_and_mapping(
-          cbegin(first_ident), cend(first_ident), it, end);
+        parse_command_and_mapping(begin, first_ident_end, it, end);
     }
     else {
       if (!skip_until(&it, end, ">>"))
@@ -189,7 +319,7 @@ void ParseConfig::parse_context(It* it, const It end) {
   auto class_filter = Config::Filter();
   auto title_filter = Config::Filter();
   auto device_filter = std::string();
-  m_context_modifier = { };
+  auto modifier = KeySequence();
 
   if (skip(it, end, "default")) {
     skip_space(it, end);
@@ -223,17 +353,16 @@ void ParseConfig::parse_context(It* it, const It end) {
           error("String expected");
       }
       else if (attrib == "modifier") {
-        auto modifier = read_value(it, end);
-        m_context_modifier = m_parse_sequence(
-          preprocess(modifier.begin(), modifier.end()), true,
-          std::bind(&ParseConfig::get_key_by_name, this, _1));
-        m_context_modifier.erase(
-          std::remove_if(m_context_modifier.begin(), m_context_modifier.end(),
+        modifier = m_parse_sequence(
+          preprocess(read_value(it, end)), true,
+          [&](std::string_view name) { return get_key_by_name(name); });
+        modifier.erase(
+          std::remove_if(modifier.begin(), modifier.end(),
             [](const KeyEvent& event) { return (event.state == KeyState::UpAsync); }),
-          m_context_modifier.end());
+          modifier.end());
       }
       else {
-        error("Unexpected '" + attrib + "'");
+        error("Unexpected '" + std::string(attrib) + "'");
       }
 
       skip_space(it, end);
@@ -252,20 +381,95 @@ void ParseConfig::parse_context(It* it, const It end) {
     std::move(title_filter),
     std::move(device_filter)
   });
+  m_context_modifiers.push_back(std::move(modifier));
 }
 
-void ParseConfig::parse_mapping(const std::string& name, It begin, It end) {
-  add_mapping(name, parse_output(begin, end));
+void ParseConfig::parse_directive(It* it, const It end) {
+  const auto directive = read_ident(it, end);
+  if (directive == "include")
+    parse_include(it, end);
+  else
+    error("Unknown directive '" + std::string(directive) + "'");
+}
+
+// the lines of the included file are parsed as if they were in place
+void ParseConfig::parse_include(It* it, const It end) {
+  skip_space(it, end);
+  auto name = std::string_view();
+  if (*it != end && (**it == '"' || **it == '\'')) {
+    name = read_value(it, end);
+  }
+  else {
+    const auto begin = *it;
+    while (*it != end && !std::isspace(static_cast<unsigned char>(**it)) &&
+           **it != '#' && **it != ';')
+      ++(*it);
+    name = to_string_view(begin, *it);
+  }
+  if (name.empty())
+    error("Filename expected");
+
+  auto path = std::filesystem::path(name);
+  if (path.is_relative())
+    path = m_directory / path;
+  const auto filename = intern(path.lexically_normal().string());
+  if (std::find(m_include_stack.begin(), m_include_stack.end(),
+        filename) != m_include_stack.end())
+    error("Recursive include of '" + std::string(filename) + "'");
+  const auto& contents = read_fragment(filename);
+
+  const auto line_no = m_line_no;
+  const auto prev_filename = std::exchange(m_filename, filename);
+  auto prev_directory = std::exchange(m_directory,
+    std::filesystem::path(filename).parent_path());
+  m_include_stack.push_back(filename);
+  parse_lines(contents);
+  m_include_stack.pop_back();
+  m_directory = std::move(prev_directory);
+  m_filename = prev_filename;
+  m_line_no = line_no;
 }
 
-bool is_ident(const std::string& string) {
+// contents of a file are read once per call, views into them are kept
+const std::string& ParseConfig::read_fragment(
+    const std::filesystem::path& filename) {
+  auto& fragment = m_fragments[filename.string()];
+  if (fragment.included)
+    return fragment.contents;
+  // also when it fails, so it can be watched
+  fragment.included = true;
+
+  auto error_code = std::error_code();
+  const auto modify_time = std::filesystem::last_write_time(
+    filename, error_code);
+  const auto size = (error_code ? 0 :
+    std::filesystem::file_size(filename, error_code));
+  if (error_code)
+    error("Opening '" + filename.string() + "' failed");
+
+  if (modify_time != fragment.modify_time || size != fragment.size) {
+    auto is = std::ifstream(filename, std::ios::in | std::ios::binary);
+    if (!is.good())
+      error("Opening '" + filename.string() + "' failed");
+    fragment.contents.assign(std::istreambuf_iterator<char>(is), { });
+    fragment.modify_time = modify_time;
+    fragment.size = size;
+  }
+  return fragment.contents;
+}
+
+void ParseConfig::parse_mapping(std::string_view name, It begin, It end) {
+  add_command_mapping(name, read_sequence(begin, end));
+}
+
+bool is_ident(std::string_view string) {
   auto it = string.begin();
   const auto end = string.end();
   skip_ident(&it, end);
   return (it == end);
 }
 
-std::string ParseConfig::parse_command_name(It it, It end) const {
+std::string_view ParseConfig::parse_command_name(It it, It end) const {
   trim_comment(it, &end);
   skip_space(&it, end);
   auto ident = preprocess_ident(read_ident(&it, end));
@@ -279,63 +483,45 @@ std::string ParseConfig::parse_command_name(It it, It end) const {
 
 void ParseConfig::parse_command_and_mapping(const It in_begin, const It in_end,
     const It out_begin, const It out_end) {
-  auto input = parse_input(in_begin, in_end);
-  auto command_name = parse_command_name(out_begin, out_end);
+  const auto input = read_sequence(in_begin, in_end);
+  const auto command_name = parse_command_name(out_begin, out_end);
   if (!command_name.empty())
-    add_command(std::move(input), std::move(command_name));
+    add_command(input, command_name);
   else
-    add_mapping(std::move(input), parse_output(out_begin, out_end));
+    add_mapping(input, read_sequence(out_begin, out_end));
 }
 
-KeySequence ParseConfig::parse_input(It it, It end) try {
+std::string_view ParseConfig::read_sequence(It it, It end) {
   skip_space(&it, end);
-  auto sequence = m_parse_sequence(preprocess(it, end), true,
-    std::bind(&ParseConfig::get_key_by_name, this, _1));
-  sequence.insert(sequence.begin(),
-    m_context_modifier.begin(), m_context_modifier.end());
-  return sequence;
-}
-catch (const std::exception& ex) {
-  error(ex.what());
+  const auto source = preprocess(to_string_view(it, end));
+  // expanded sequences need to outlive the buffer
+  if (source.data() == m_preprocessed.data())
+    return intern(source);
+  return source;
 }
 
-Key ParseConfig::get_key_by_name(std::string_view name) const {
+Key ParseConfig::get_key_by_name(std::string_view name,
+    size_t logical_key_count) const {
   if (const auto key = ::get_key_by_name(name); key != Key::none)
     return key;
 
-  const auto it = std::find_if(m_logical_keys.begin(), m_logical_keys.end(),
-    [&](const LogicalKey& key) { return key.name == name; });
-  if (it != m_logical_keys.end())
-    return it->both;
+  const auto it = m_logical_key_names.find(name);
+  if (it != m_logical_key_names.end() &&
+      static_cast<size_t>(*it->second - *Key::first_logical) < logical_key_count)
+    return it->second;
 
   return { };
 }
 
-Key ParseConfig::add_terminal_command_action(std::string_view command) {
-  const auto action_key_code =
-    static_cast<Key>(*Key::first_action + m_config.actions.size());
-  m_config.actions.push_back({ std::string(command) });
-  return action_key_code;
-}
 
-KeySequence ParseConfig::parse_output(It it, It end) try {
-  skip_space(&it, end);
-  return m_parse_sequence(preprocess(it, end), false,
-    std::bind(&ParseConfig::get_key_by_name, this, _1),
-    std::bind(&ParseConfig::add_terminal_command_action, this, _1));
-}
-catch (const std::exception& ex) {
-  error(ex.what());
-}
-
-void ParseConfig::parse_macro(std::string name, It it, const It end) {
+void ParseConfig::parse_macro(std::string_view name, It it, const It end) {
   if (*get_key_by_name(name))
-    error("Invalid macro name '" + name + "'");
-  m_macros[std::move(name)] = preprocess(it, end);
+    error("Invalid macro name '" + std::string(name) + "'");
+  m_macros[intern(name)] = preprocess(to_string_view(it, end));
 }
 
 bool ParseConfig::parse_logical_key_definition(
-    const std::string& logical_name, It it, const It end) {
+    std::string_view logical_name, It it, const It end) {
   if (*get_key_by_name(logical_name))
     return false;
 
@@ -349,7 +535,7 @@ bool ParseConfig::parse_logical_key_definition(
     const auto name = preprocess_ident(read_ident(&it, end));
     const auto right = get_key_by_name(name);
     if (!*right)
-      error("Invalid key '" + name + "'");
+      error("Invalid key '" + std::string(name) + "'");
     skip_space(&it, end);
     if (skip(&it, end, "|")) {
       left = add_logical_key("$", left, right);
@@ -363,35 +549,48 @@ bool ParseConfig::parse_logical_key_definition(
   return true;
 }
 
-std::string ParseConfig::preprocess_ident(std::string ident) const {
+std::string_view ParseConfig::preprocess_ident(std::string_view ident) const {
   const auto macro = m_macros.find(ident);
   if (macro != cend(m_macros))
     return macro->second;
   return ident;
 }
 
-std::string ParseConfig::preprocess(It it, const It end) const {
-  auto result = std::string();
+// returns a view of the source, until a macro needs to be expanded,
+// only valid until next call
+std::string_view ParseConfig::preprocess(std::string_view source) {
+  auto it = source.begin();
+  const auto end = source.end();
   // remove comments
   skip_space_and_comments(&it, end);
 
-  for (;;) {
-    if (it == end)
-      break;
-
+  const auto source_begin = it;
+  auto expanded = false;
+  while (it != end) {
     // try to read ident
     auto begin = it;
     skip_ident(&it, end);
-    if (begin != it) {
-      // match read ident
-      result.append(preprocess_ident(std::string(begin, it)));
+    if (begin == it) {
+      // single character
+      if (expanded)
+        m_preprocessed.push_back(*it);
+      ++it;
+      continue;
     }
-    else {
-      // output single character
-      result.append(begin, ++it);
+    const auto ident = to_string_view(begin, it);
+    const auto macro = m_macros.find(ident);
+    if (macro != cend(m_macros)) {
+      if (!std::exchange(expanded, true))
+        m_preprocessed.assign(source_begin, begin);
+      m_preprocessed.append(macro->second);
+    }
+    else if (expanded) {
+      m_preprocessed.append(ident);
     }
   }
-  return result;
+  if (expanded)
+    return m_preprocessed;
+  return to_string_view(source_begin, end);
 }
 
 Config::Context& ParseConfig::current_context() {
@@ -399,95 +598,282 @@ Config::Context& ParseConfig::current_context() {
   return m_config.contexts.back();
 }
 
-auto ParseConfig::find_command(const std::string& name) -> Command* {
-  const auto it = std::find_if(
-    begin(m_commands), end(m_commands),
-    [&](const Command& c) { return c.name == name; });
-  return (it != cend(m_commands) ? &*it : nullptr);
+std::string_view ParseConfig::intern(std::string_view string) {
+  return *m_strings.emplace(string).first;
 }
 
-void ParseConfig::add_command(KeySequence input, std::string name) {
+auto ParseConfig::find_command(std::string_view name) -> Command* {
+  const auto it = m_command_indices.find(name);
+  return (it != cend(m_command_indices) ? &m_commands[it->second] : nullptr);
+}
+
+void ParseConfig::add_pending_sequence(std::string_view source,
+    PendingSequence::Target target, int index) {
+  m_pending_sequences.push_back({
+    source,
+    m_filename,
+    m_line_no,
+    m_logical_keys.size(),
+    static_cast<int>(m_config.contexts.size()) - 1,
+    target,
+    index,
+    { },
+    false
+  });
+}
+
+void ParseConfig::add_command(std::string_view input, std::string_view name) {
   assert(!name.empty());
   auto& context = current_context();
   auto command = find_command(name);
   if (!command) {
     // command outputs have a negative index
     const auto output_index = -static_cast<int>(m_commands.size() + 1);
-    m_commands.push_back({ std::move(name), output_index, false });
+    const auto interned = intern(name);
+    m_command_indices.emplace(interned, static_cast<int>(m_commands.size()));
+    m_commands.push_back({ interned, output_index, -1 });
     command = &m_commands.back();
   }
-  context.inputs.push_back({ std::move(input), command->index });
+  add_pending_sequence(input, PendingSequence::Target::input,
+    static_cast<int>(context.inputs.size()));
+  context.inputs.push_back({ { }, command->index });
 }
 
-void ParseConfig::add_mapping(KeySequence input, KeySequence output) {
-  assert(!input.empty());
+void ParseConfig::add_mapping(std::string_view input, std::string_view output) {
   auto& context = current_context();
+  add_pending_sequence(input, PendingSequence::Target::input,
+    static_cast<int>(context.inputs.size()));
+  add_pending_sequence(output, PendingSequence::Target::output,
+    static_cast<int>(context.outputs.size()));
   context.inputs.push_back({
-    std::move(input),
+    { },
     static_cast<int>(context.outputs.size())
   });
-  context.outputs.push_back(std::move(output));
+  context.outputs.emplace_back();
 }
 
-void ParseConfig::add_mapping(const std::string& name, KeySequence output) {
+void ParseConfig::add_command_mapping(std::string_view name,
+    std::string_view output) {
   assert(!name.empty());
   auto& context = current_context();
+  // output is parsed before the mapping is checked
+  add_pending_sequence(output, PendingSequence::Target::command_output,
+    static_cast<int>(context.command_outputs.size()));
+  context.command_outputs.emplace_back();
+
   auto command = find_command(name);
   if (!command)
-    error("Unknown command '" + name + "'");
+    error("Unknown command '" + std::string(name) + "'");
 
-  if (std::count_if(begin(context.command_outputs), end(context.command_outputs),
-      [&](const Config::CommandOutput& output) { return output.index == command->index; }))
-    error("Duplicate mapping of '" + name + "'");
+  const auto context_index = static_cast<int>(m_config.contexts.size()) - 1;
+  if (command->mapped_context == context_index)
+    error("Duplicate mapping of '" + std::string(name) + "'");
 
-  context.command_outputs.push_back({
-    std::move(output),
-    command->index
+  context.command_outputs.back().index = command->index;
+  command->mapped_context = context_index;
+}
+
+KeySequence& ParseConfig::get_target(const PendingSequence& sequence) {
+  auto& context = m_config.contexts[static_cast<size_t>(sequence.context_index)];
+  const auto index = static_cast<size_t>(sequence.index);
+  switch (sequence.target) {
+    case PendingSequence::Target::input: return context.inputs[index].input;
+    case PendingSequence::Target::output: return context.outputs[index];
+    case PendingSequence::Target::command_output: break;
+  }
+  return context.command_outputs[index].output;
+}
+
+// parses a chunk of the pending sequences, stops at the first error
+void ParseConfig::parse_pending_sequences(size_t begin, size_t end,
+    std::pair<size_t, std::string>* error) {
+  auto parse_sequence = ParseKeySequence();
+  for (auto i = begin; i < end; ++i) {
+    auto& sequence = m_pending_sequences[i];
+    if (sequence.reused)
+      continue;
+    const auto is_input = (sequence.target == PendingSequence::Target::input);
+    const auto get_key = [&](std::string_view name) {
+      return get_key_by_name(name, sequence.logical_key_count);
+    };
+    const auto add_action = [&](std::string_view command) {
+      // actions are numbered after all chunks were parsed
+      sequence.actions.emplace_back(command);
+      return static_cast<Key>(*Key::first_action + sequence.actions.size() - 1);
+    };
+    try {
+      auto& target = get_target(sequence);
+      target = parse_sequence(sequence.source, is_input, get_key,
+        (is_input ? ParseKeySequence::AddTerminalCommand() :
+          ParseKeySequence::AddTerminalCommand(add_action)));
+
+      if (is_input) {
+        const auto& modifier = m_context_modifiers[
+          static_cast<size_t>(sequence.context_index)];
+        target.insert(target.begin(), modifier.begin(), modifier.end());
+      }
+    }
+    catch (const std::exception& ex) {
+      *error = { i, std::string(ex.what()) +
+        get_location(sequence.filename, sequence.line_no) };
+      return;
+    }
+  }
+}
+
+void ParseConfig::parse_pending_sequences() {
+  const auto count = m_pending_sequences.size();
+  const auto chunks = (count + pending_sequences_per_chunk - 1) /
+    pending_sequences_per_chunk;
+  auto errors = std::vector<std::pair<size_t, std::string>>(chunks,
+    { count, "" });
+  parallel_for_chunks(count, [&](size_t chunk, size_t begin, size_t end) {
+    parse_pending_sequences(begin, end, &errors[chunk]);
   });
-  command->mapped = true;
+
+  // report the error of the first line
+  const auto error = std::min_element(errors.begin(), errors.end(),
+    [](const auto& a, const auto& b) { return a.first < b.first; });
+  if (error != errors.end() && error->first < count)
+    throw ParseError(error->second);
+}
+
+// the sequences of a context only depend on its modifier, their sources
+// and the logical keys which were defined before
+std::vector<uint64_t> ParseConfig::reuse_parsed_sequences() {
+  auto logical_key_hashes = std::vector<uint64_t>{ fnv_offset_basis };
+  for (const auto& logical_key : m_logical_keys)
+    logical_key_hashes.push_back(
+      hash_append(logical_key_hashes.back(), logical_key.name));
+
+  auto hashes = std::vector<uint64_t>();
+  for (const auto& modifier : m_context_modifiers)
+    hashes.push_back(hash_append(fnv_offset_basis, modifier));
+  for (const auto& sequence : m_pending_sequences) {
+    auto& hash = hashes[static_cast<size_t>(sequence.context_index)];
+    hash = hash_append(hash, sequence.target);
+    hash = hash_append(hash, sequence.index);
+    hash = hash_append(hash, logical_key_hashes[sequence.logical_key_count]);
+    hash = hash_append(hash, sequence.source);
+  }
+
+  // sequences are ordered by context
+  for (auto begin = size_t{ }; begin < m_pending_sequences.size(); ) {
+    const auto context_index = m_pending_sequences[begin].context_index;
+    auto end = begin + 1;
+    while (end < m_pending_sequences.size() &&
+           m_pending_sequences[end].context_index == context_index)
+      ++end;
+
+    const auto it = m_parsed_contexts.find(
+      hashes[static_cast<size_t>(context_index)]);
+    if (it != m_parsed_contexts.end() && it->second.size() == end - begin)
+      for (auto i = begin; i < end; ++i) {
+        auto& sequence = m_pending_sequences[i];
+        const auto& parsed = it->second[i - begin];
+        get_target(sequence) = parsed.sequence;
+        sequence.actions = parsed.actions;
+        sequence.reused = true;
+      }
+    begin = end;
+  }
+  return hashes;
+}
+
+void ParseConfig::store_parsed_sequences(
+    const std::vector<uint64_t>& source_hashes) {
+  auto parsed_contexts = decltype(m_parsed_contexts)();
+  auto context_index = -1;
+  auto parsed = static_cast<std::vector<ParsedSequence>*>(nullptr);
+  for (const auto& sequence : m_pending_sequences) {
+    if (sequence.context_index != context_index) {
+      context_index = sequence.context_index;
+      const auto hash = source_hashes[static_cast<size_t>(context_index)];
+      parsed = nullptr;
+      if (parsed_contexts.count(hash))
+        continue;
+      // take over sequences of unchanged contexts
+      if (sequence.reused) {
+        parsed_contexts.insert(m_parsed_contexts.extract(hash));
+        continue;
+      }
+      parsed = &parsed_contexts[hash];
+    }
+    if (parsed)
+      parsed->push_back({ get_target(sequence), sequence.actions });
+  }
+  m_parsed_contexts = std::move(parsed_contexts);
+}
+
+void ParseConfig::number_actions_and_hash_contexts(
+    const std::vector<uint64_t>& source_hashes) {
+  auto first_actions = std::vector<int>(m_config.contexts.size(), -1);
+  for (auto& sequence : m_pending_sequences) {
+    if (sequence.actions.empty())
+      continue;
+    const auto offset = static_cast<int>(m_config.actions.size());
+    auto& first_action = first_actions[static_cast<size_t>(sequence.context_index)];
+    if (first_action < 0)
+      first_action = offset;
+    for (auto& event : get_target(sequence))
+      if (is_action_key(event.key))
+        event.key = static_cast<Key>(*event.key + offset);
+    for (auto& command : sequence.actions)
+      m_config.actions.push_back({ std::move(command) });
+  }
+
+  for (auto i = size_t{ }; i < m_config.contexts.size(); ++i) {
+    auto& context = m_config.contexts[i];
+    auto hash = hash_append(source_hashes[i], first_actions[i]);
+    for (const auto& input : context.inputs)
+      hash = hash_append(hash, input.output_index);
+    for (const auto& command : context.command_outputs)
+      hash = hash_append(hash, command.index);
+    hash = hash_append(hash, context.system_filter_matched);
+    hash = hash_append(hash, context.window_class_filter.string);
+    hash = hash_append(hash, context.window_title_filter.string);
+    context.hash = hash_append(hash, context.device_filter);
+  }
 }
 
-Key ParseConfig::add_logical_key(std::string name, Key left, Key right) {
+Key ParseConfig::add_logical_key(std::string_view name, Key left, Key right) {
   const auto both = static_cast<Key>(*Key::first_logical + m_logical_keys.size());
-  m_logical_keys.push_back({ std::move(name), both, left, right });
+  const auto interned = intern(name);
+  m_logical_key_names.emplace(interned, both);
+  m_logical_keys.push_back({ interned, both, left, right });
   return both;
 }
 
-void ParseConfig::replace_logical_key(Key both, Key left, Key right) {
+void ParseConfig::resolve_logical_keys() {
+  // flatten nested logical keys to the physical keys they match
+  auto& logical_keys = m_config.logical_keys;
+  logical_keys.reserve(m_logical_keys.size());
+  for (const auto& logical_key : m_logical_keys) {
+    auto keys = std::vector<Key>();
+    for (auto key : { logical_key.left, logical_key.right }) {
+      const auto members = (is_logical_key(key) ?
+        get_logical_key_members(logical_keys, key) : std::vector<Key>{ key });
+      for (auto member : members)
+        if (std::find(keys.begin(), keys.end(), member) == keys.end())
+          keys.push_back(member);
+    }
+    logical_keys.push_back(std::move(keys));
+  }
+
+  // inputs keep the logical keys, they are matched by the runtime,
+  // which also outputs the key a logical key matched in direct outputs
   for (auto& context : m_config.contexts) {
-    // replace !<both> with !<left> !<right>
-    for (auto& input : context.inputs)
-      replace_not_key(input.input, both, left, right);
-    for (auto& output : context.outputs)
-      replace_not_key(output, both, left, right);
-    for (auto& command : context.command_outputs)
-      replace_not_key(command.output, both, left, right);
-
-    // duplicate command and replace the logical with a physical key
-    for (auto it = begin(context.inputs); it != end(context.inputs); ++it)
-      if (contains(it->input, both)) {
-        // duplicate and replace with <left> and <right>
-        it = context.inputs.insert(it, *it);
-        replace_key(it->input, both, left);
-        ++it;
-        replace_key(it->input, both, right);
-
-        // when directly mapped output also contains logical key,
-        // then duplicate output and replace with <right>
-        if (it->output_index >= 0) {
-          auto& output = context.outputs[it->output_index];
-          if (contains(output, both)) {
-            it->output_index = static_cast<int>(context.outputs.size());
-            context.outputs.push_back(output);
-            replace_key(context.outputs.back(), both, right);
-          }
-        }
-      }
+    for (auto& output : context.outputs) {
+      context.hash = hash_logical_keys(context.hash, output, logical_keys);
+      expand_not_logical_keys(output, logical_keys);
+    }
 
-    // replace logical key with <left>
-    for (auto& output : context.outputs)
-      replace_key(output, both, left);
-    for (auto& command : context.command_outputs)
-      replace_key(command.output, both, left);
+    // command outputs can be shared, so always output the first key
+    for (auto& command : context.command_outputs) {
+      context.hash = hash_logical_keys(context.hash,
+        command.output, logical_keys);
+      expand_not_logical_keys(command.output, logical_keys);
+      replace_logical_keys(command.output, logical_keys);
+    }
   }
 }
@@ -3,60 +3,128 @@
 #include "runtime/KeyEvent.h"
 #include "Config.h"
 #include "ParseKeySequence.h"
+#include <filesystem>
 #include <iosfwd>
-#include <map>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 
 class ParseConfig {
 public:
   Config operator()(std::istream& is);
+  // relative includes are resolved from the base directory
+  Config operator()(std::string_view contents,
+    const std::filesystem::path& base_directory = { });
+  // the files included by the last call
+  std::vector<std::filesystem::path> included_files() const;
 
 private:
   struct Command {
-    std::string name;
+    std::string_view name;
     int index;
-    bool mapped;
+    // index of last context it was mapped in
+    int mapped_context;
   };
 
   struct LogicalKey {
-    std::string name;
+    std::string_view name;
     Key both;
     Key left;
     Key right;
   };
 
-  using It = std::string::const_iterator;
+  // key sequences are parsed after all lines were read, possibly in
+  // parallel, since they only depend on the definitions which preceded them
+  struct PendingSequence {
+    enum class Target { input, output, command_output };
+
+    std::string_view source;
+    std::string_view filename;
+    int line_no;
+    size_t logical_key_count;
+    int context_index;
+    Target target;
+    int index;
+    std::vector<std::string> actions;
+    bool reused;
+  };
+
+  struct ParsedSequence {
+    KeySequence sequence;
+    std::vector<std::string> actions;
+  };
+
+  // included files are only read again when they were modified
+  struct Fragment {
+    std::filesystem::file_time_type modify_time;
+    uintmax_t size;
+    std::string contents;
+    bool included;
+  };
+
+  using It = std::string_view::const_iterator;
 
   [[noreturn]] void error(std::string message);
+  void parse_lines(std::string_view contents);
   void parse_line(It begin, It end);
+  void parse_directive(It* begin, It end);
+  void parse_include(It* begin, It end);
+  const std::string& read_fragment(const std::filesystem::path& filename);
   void parse_context(It* begin, It end);
-  void parse_macro(std::string name, It begin, It end);
-  bool parse_logical_key_definition(const std::string& name, It it, It end);
-  void parse_mapping(const std::string& name, It begin, It end);
-  std::string parse_command_name(It begin, It end) const;
+  void parse_macro(std::string_view name, It begin, It end);
+  bool parse_logical_key_definition(std::string_view name, It it, It end);
+  void parse_mapping(std::string_view name, It begin, It end);
+  std::string_view parse_command_name(It begin, It end) const;
   void parse_command_and_mapping(It in_begin, It in_end,
                                  It out_begin, It out_end);
-  KeySequence parse_input(It begin, It end);
-  KeySequence parse_output(It begin, It end);
-  std::string preprocess_ident(std::string ident) const;
-  std::string preprocess(It begin, It end) const;
-  Key add_logical_key(std::string name, Key left, Key right);
-  void replace_logical_key(Key both, Key left, Key right);
+  std::string_view read_sequence(It begin, It end);
+  std::string_view preprocess_ident(std::string_view ident) const;
+  std::string_view preprocess(std::string_view source);
+  Key add_logical_key(std::string_view name, Key left, Key right);
+  void resolve_logical_keys();
   std::string read_filter_string(It* it, It end);
   Config::Filter read_filter(It* it, It end);
-  Key get_key_by_name(std::string_view name) const;
-  Key add_terminal_command_action(std::string_view command);
+  // only finds the logical keys which were defined before
+  Key get_key_by_name(std::string_view name, size_t logical_key_count =
+    std::numeric_limits<size_t>::max()) const;
 
+  std::string_view intern(std::string_view string);
   Config::Context& current_context();
-  Command* find_command(const std::string& name);
-  void add_command(KeySequence input, std::string name);
-  void add_mapping(KeySequence input, KeySequence output);
-  void add_mapping(const std::string& name, KeySequence output);
+  Command* find_command(std::string_view name);
+  void add_pending_sequence(std::string_view source,
+    PendingSequence::Target target, int index);
+  void add_command(std::string_view input, std::string_view name);
+  void add_mapping(std::string_view input, std::string_view output);
+  void add_command_mapping(std::string_view name, std::string_view output);
+  KeySequence& get_target(const PendingSequence& sequence);
+  void parse_pending_sequences(size_t begin, size_t end,
+    std::pair<size_t, std::string>* error);
+  void parse_pending_sequences();
+  std::vector<uint64_t> reuse_parsed_sequences();
+  void store_parsed_sequences(const std::vector<uint64_t>& source_hashes);
+  void number_actions_and_hash_contexts(
+    const std::vector<uint64_t>& source_hashes);
 
   int m_line_no{ };
+  // of the included file being parsed, empty for the main file
+  std::string_view m_filename;
+  std::filesystem::path m_directory;
+  std::vector<std::string_view> m_include_stack;
+  std::unordered_map<std::string, Fragment> m_fragments;
   Config m_config;
+  // symbol tables are keyed by views into the string pool
+  std::unordered_set<std::string> m_strings;
   std::vector<Command> m_commands;
-  std::map<std::string, std::string> m_macros;
+  std::unordered_map<std::string_view, int> m_command_indices;
+  std::unordered_map<std::string_view, std::string> m_macros;
   std::vector<LogicalKey> m_logical_keys;
+  std::unordered_map<std::string_view, Key> m_logical_key_names;
+  std::vector<PendingSequence> m_pending_sequences;
+  // sequences of the contexts parsed by the last call, by their sources
+  std::unordered_map<uint64_t, std::vector<ParsedSequence>> m_parsed_contexts;
   ParseKeySequence m_parse_sequence;
-  KeySequence m_context_modifier;
+  // only allocated when macros were expanded
+  std::string m_preprocessed;
+  std::vector<KeySequence> m_context_modifiers;
 };
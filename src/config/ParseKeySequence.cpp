@@ -18,20 +18,21 @@ namespace {
 } // namespace
 
 KeySequence ParseKeySequence::operator()(
-    const std::string& str, bool is_input,
+    std::string_view str, bool is_input,
     GetKeyByName get_key_by_name,
     AddTerminalCommand add_terminal_command) {
 
   m_is_input = is_input;
-  m_get_key_by_name = std::move(get_key_by_name);
-  m_add_terminal_command = std::move(add_terminal_command);
+  m_get_key_by_name = get_key_by_name;
+  m_add_terminal_command = add_terminal_command;
   m_keys_not_up.clear();
   m_key_buffer.clear();
   m_sequence.clear();
 
   parse(cbegin(str), cend(str));
 
-  return std::move(m_sequence);
+  // copy, so the buffer keeps its capacity
+  return m_sequence;
 }
 
 void ParseKeySequence::add_key_to_sequence(Key key, KeyState state) {
@@ -113,14 +114,14 @@ void ParseKeySequence::remove_any_up_from_end() {
 }
 
 Key ParseKeySequence::read_key(It* it, const It end) {
-  auto key_name = read_ident(it, end);
+  const auto key_name = read_ident(it, end);
   if (key_name.empty()) {
     const char at = *(*it == end ? std::prev(*it) : *it);
     throw ParseError("Key name expected at '" + std::string(1, at) + "'");
   }
   if (const auto key = m_get_key_by_name(key_name); key != Key::none)
     return key;
-  throw ParseError("Invalid key '" + key_name + "'");
+  throw ParseError("Invalid key '" + std::string(key_name) + "'");
 }
 
 void ParseKeySequence::add_timeout_event(KeyState state, uint16_t timeout) {
@@ -166,7 +167,8 @@ void ParseKeySequence::parse(It it, const It end) {
       add_key_to_sequence(key, KeyState::Not);
     }
     else if (skip(&it, end, "$")) {
-      if (m_is_input || in_together_group || in_modified_group)
+      if (m_is_input || in_together_group || in_modified_group ||
+          !m_add_terminal_command)
         throw ParseError("Unexpected '$'");
       if (!skip(&it, end, "("))
         throw ParseError("Expected '('");
@@ -1,10 +1,11 @@
 #pragma once
 
 #include "get_key_name.h"
+#include "FunctionRef.h"
 #include "runtime/KeyEvent.h"
 #include <stdexcept>
 #include <string>
-#include <functional>
+#include <string_view>
 
 // Here are some examples for input and output expressions. Each example
 // consists of a description of the desired result, followed by the
@@ -42,15 +43,16 @@ struct ParseError : std::runtime_error {
 
 class ParseKeySequence {
 public:
-  using GetKeyByName = std::function<Key(std::string_view)>;
-  using AddTerminalCommand = std::function<Key(std::string_view)>;
+  // the callables are only referenced during the call
+  using GetKeyByName = FunctionRef<Key(std::string_view)>;
+  using AddTerminalCommand = FunctionRef<Key(std::string_view)>;
 
-  KeySequence operator()(const std::string& str, bool is_input,
+  KeySequence operator()(std::string_view str, bool is_input,
     GetKeyByName get_key_by_name = ::get_key_by_name,
     AddTerminalCommand add_terminal_command = { });
 
 private:
-  using It = std::string::const_iterator;
+  using It = std::string_view::const_iterator;
 
   void parse(It it, const It end);
   Key read_key(It* it, const It end);
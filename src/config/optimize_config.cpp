@@ -0,0 +1,137 @@
+
+#include "optimize_config.h"
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+  using KeySequenceSet = std::unordered_set<KeySequence, KeySequenceHash>;
+
+  bool is_always_active(const Config::Context& context) {
+    return (context.window_class_filter.string.empty() &&
+            context.window_title_filter.string.empty() &&
+            context.device_filter.empty());
+  }
+
+  bool contains_timeout(const KeySequence& sequence) {
+    return std::any_of(sequence.begin(), sequence.end(),
+      [](const KeyEvent& event) { return (event.key == Key::timeout); });
+  }
+
+  // inputs are matched top-down, the first one which finds an output wins
+  void remove_shadowed_inputs(Config::Context& context,
+      const KeySequenceSet& always_shadowing, KeySequenceSet* shadowing,
+      const std::unordered_map<int, size_t>& always_mapped_commands,
+      ConfigOptimizations* result) {
+    auto inputs = std::vector<Config::Input>();
+    inputs.reserve(context.inputs.size());
+    for (auto& input : context.inputs) {
+      if (always_shadowing.count(input.input) ||
+          shadowing->count(input.input)) {
+        ++result->shadowed_inputs;
+        continue;
+      }
+      if (input.output_index >= 0 ||
+          always_mapped_commands.count(input.output_index))
+        shadowing->insert(input.input);
+      inputs.push_back(std::move(input));
+    }
+    context.inputs = std::move(inputs);
+  }
+
+  // removes unreferenced outputs and merges identical ones, except those
+  // of inputs with timeouts, since the stage tells them apart by address
+  void merge_outputs(Config::Context& context, ConfigOptimizations* result) {
+    auto outputs = std::vector<KeySequence>();
+    auto output_indices = std::vector<int>(context.outputs.size(), -1);
+    auto merged = std::unordered_map<KeySequence, int, KeySequenceHash>();
+    for (auto& input : context.inputs) {
+      if (input.output_index < 0)
+        continue;
+      auto& index = output_indices[static_cast<size_t>(input.output_index)];
+      if (index < 0) {
+        auto& output = context.outputs[static_cast<size_t>(input.output_index)];
+        index = static_cast<int>(outputs.size());
+        if (!contains_timeout(input.input)) {
+          const auto [it, inserted] = merged.emplace(output, index);
+          if (!inserted) {
+            ++result->duplicate_outputs;
+            input.output_index = it->second;
+            continue;
+          }
+        }
+        outputs.push_back(std::move(output));
+      }
+      input.output_index = index;
+    }
+    context.outputs = std::move(outputs);
+  }
+} // namespace
+
+ConfigOptimizations optimize_config(Config& config) {
+  auto result = ConfigOptimizations{ };
+  auto& contexts = config.contexts;
+
+  // the last always active context a command is mapped in,
+  // overrides its mappings in the preceding contexts
+  auto always_mapped_commands = std::unordered_map<int, size_t>();
+  for (auto i = size_t{ }; i < contexts.size(); ++i)
+    if (is_always_active(contexts[i]))
+      for (const auto& command : contexts[i].command_outputs)
+        always_mapped_commands[command.index] = i;
+
+  // an input which always finds an output shadows the identical inputs
+  // following in its context, or in all contexts when it is always active
+  auto modified = std::vector<bool>(contexts.size());
+  auto always_shadowing = KeySequenceSet();
+  auto shadowing = KeySequenceSet();
+  auto mapped_commands = std::unordered_set<int>();
+  for (auto i = size_t{ }; i < contexts.size(); ++i) {
+    auto& context = contexts[i];
+    const auto input_count = context.inputs.size();
+    const auto output_count = context.outputs.size();
+    remove_shadowed_inputs(context, always_shadowing, &shadowing,
+      always_mapped_commands, &result);
+    merge_outputs(context, &result);
+    modified[i] = (context.inputs.size() != input_count ||
+                   context.outputs.size() != output_count);
+
+    for (const auto& input : context.inputs)
+      if (input.output_index < 0)
+        mapped_commands.insert(input.output_index);
+
+    if (is_always_active(context))
+      always_shadowing.merge(shadowing);
+    shadowing.clear();
+  }
+
+  // remove overridden mappings and those of commands without inputs
+  for (auto i = size_t{ }; i < contexts.size(); ++i) {
+    auto& command_outputs = contexts[i].command_outputs;
+    const auto end = std::remove_if(command_outputs.begin(),
+      command_outputs.end(), [&](const Config::CommandOutput& command) {
+        const auto it = always_mapped_commands.find(command.index);
+        return ((it != always_mapped_commands.end() && it->second > i) ||
+                !mapped_commands.count(command.index));
+      });
+    if (end != command_outputs.end()) {
+      result.unreachable_command_outputs +=
+        static_cast<int>(std::distance(end, command_outputs.end()));
+      command_outputs.erase(end, command_outputs.end());
+      modified[i] = true;
+    }
+  }
+
+  // contents of modified contexts are no longer identified by the hash
+  for (auto i = size_t{ }; i < contexts.size(); ++i)
+    if (modified[i])
+      contexts[i].hash = 0;
+
+  const auto end = std::remove_if(contexts.begin(), contexts.end(),
+    [](const Config::Context& context) {
+      return (context.inputs.empty() && context.command_outputs.empty());
+    });
+  result.empty_contexts = static_cast<int>(std::distance(end, contexts.end()));
+  contexts.erase(end, contexts.end());
+  return result;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "Config.h"
+
+// what optimize_config removed
+struct ConfigOptimizations {
+  int shadowed_inputs;
+  int unreachable_command_outputs;
+  int duplicate_outputs;
+  int empty_contexts;
+};
+
+// removes mappings which can never be applied and merges identical outputs
+ConfigOptimizations optimize_config(Config& config);
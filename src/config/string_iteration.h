@@ -1,8 +1,19 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <iterator>
 #include <cctype>
 
+// views of the contiguous range, which must outlive it
+template<typename ForwardIt>
+std::string_view to_string_view(ForwardIt begin, ForwardIt end) {
+  if (begin == end)
+    return { };
+  return std::string_view(&*begin,
+    static_cast<size_t>(std::distance(begin, end)));
+}
+
 template<typename ForwardIt>
 bool skip(ForwardIt* it, ForwardIt end, const char* str) {
   auto it2 = *it;
@@ -90,23 +101,23 @@ void skip_ident(ForwardIt* it, ForwardIt end) {
 }
 
 template<typename ForwardIt>
-std::string read_value(ForwardIt* it, ForwardIt end) {
+std::string_view read_value(ForwardIt* it, ForwardIt end) {
   const auto begin = *it;
   if (skip(it, end, "'") || skip(it, end, "\"")) {
     const char mark[2] = { *(*it - 1), '\0' };
     if (skip_until(it, end, mark))
-      return std::string(begin + 1, *it - 1);
-    return std::string();
+      return to_string_view(begin + 1, *it - 1);
+    return { };
   }
   skip_value(it, end);
-  return std::string(begin, *it);
+  return to_string_view(begin, *it);
 }
 
 template<typename ForwardIt>
-std::string read_ident(ForwardIt* it, ForwardIt end) {
+std::string_view read_ident(ForwardIt* it, ForwardIt end) {
   const auto begin = *it;
   skip_ident(it, end);
-  return std::string(begin, *it);
+  return to_string_view(begin, *it);
 }
 
 template<typename ForwardIt>
@@ -276,3 +276,7 @@ inline bool is_mouse_button(Key key) {
 inline bool is_action_key(Key key) {
   return (key >= Key::first_action && key <= Key::last_action);
 }
+
+inline bool is_logical_key(Key key) {
+  return (key >= Key::first_logical && key <= Key::last_logical);
+}
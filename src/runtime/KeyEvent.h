@@ -58,6 +58,19 @@ public:
   }
 };
 
+// allows to intern identical key sequences
+struct KeySequenceHash {
+  size_t operator()(const KeySequence& sequence) const {
+    // FNV-1a
+    auto hash = uint64_t{ 14695981039346656037ull };
+    for (const auto& event : sequence) {
+      hash ^= (static_cast<uint64_t>(*event.key) << 16) | event.data;
+      hash *= 1099511628211ull;
+    }
+    return static_cast<size_t>(hash);
+  }
+};
+
 template<typename It>
 class Range {
 public:
@@ -85,5 +98,9 @@ private:
   Iterator m_end;
 };
 
+// keys matched by each logical key, indexed by offset to Key::first_logical,
+// the first key is output when the logical key was not matched in input
+using LogicalKeys = std::vector<std::vector<Key>>;
+
 using ConstKeySequenceRange = Range<KeySequence::const_iterator>;
 using KeySequenceRange = Range<KeySequence::iterator>;
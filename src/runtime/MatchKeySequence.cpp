@@ -42,8 +42,68 @@ namespace {
       return timeout_unifiable(a, b);
     return unifiable(a.state, b.state);
   }
+
+  uint64_t get_key_bit(Key key) {
+    return uint64_t{ 1 } << (*key % 64);
+  }
 } // namespace
 
+void MatchKeySequence::set_logical_keys(const LogicalKeys& logical_keys) {
+  m_logical_keys.clear();
+  for (const auto& keys : logical_keys) {
+    auto& logical_key = m_logical_keys.emplace_back();
+    logical_key.bits = { };
+    logical_key.keys = keys;
+    for (auto key : keys)
+      logical_key.bits |= get_key_bit(key);
+  }
+}
+
+bool MatchKeySequence::is_member(Key key, Key logical_key) const {
+  if (!is_logical_key(logical_key))
+    return false;
+  const auto index = static_cast<size_t>(*logical_key - *Key::first_logical);
+  if (index >= m_logical_keys.size())
+    return false;
+  const auto& logical = m_logical_keys[index];
+  if (!(logical.bits & get_key_bit(key)))
+    return false;
+  return std::find(logical.keys.begin(), logical.keys.end(), key) !=
+    logical.keys.end();
+}
+
+// first parameter needs to be from sequence
+bool MatchKeySequence::unifiable_key(Key sequence_key, Key expression_key) const {
+  if (!is_logical_key(expression_key))
+    return unifiable(sequence_key, expression_key);
+
+  for (const auto& [logical_key, key] : m_logical_key_matches)
+    if (logical_key == expression_key)
+      return (key == sequence_key);
+
+  if (!is_member(sequence_key, expression_key))
+    return false;
+  m_logical_key_matches.emplace_back(expression_key, sequence_key);
+  return true;
+}
+
+bool MatchKeySequence::unifiable_event(const KeyEvent& se, const KeyEvent& ee) const {
+  if (!is_logical_key(ee.key))
+    return unifiable(se, ee);
+  return (unifiable(se.state, ee.state) && unifiable_key(se.key, ee.key));
+}
+
+Key MatchKeySequence::get_logical_key_match(Key logical_key) const {
+  for (const auto& [logical, key] : m_logical_key_matches)
+    if (logical == logical_key)
+      return key;
+
+  const auto index = static_cast<size_t>(*logical_key - *Key::first_logical);
+  if (index >= m_logical_keys.size() || m_logical_keys[index].keys.empty())
+    return Key::none;
+  return m_logical_keys[index].keys.front();
+}
+
 MatchResult MatchKeySequence::operator()(const KeySequence& expression,
                                          ConstKeySequenceRange sequence,
                                          std::vector<Key>* any_key_matches,
@@ -56,6 +116,7 @@ MatchResult MatchKeySequence::operator()(const KeySequence& expression,
   auto e = 0u;
   auto s = 0u;
   m_async.clear();
+  m_logical_key_matches.clear();
 
   while (e < expression.size() || s < sequence.size()) {
     const auto& se = (s < sequence.size() ? sequence[s] : matches_none);
@@ -73,13 +134,13 @@ MatchResult MatchKeySequence::operator()(const KeySequence& expression,
       const auto it = std::find_if(sequence.begin() + s, sequence.end(),
         [&](const KeyEvent& e) {
           return (unifiable(e.state, KeyState::Down) &&
-                  unifiable(e.key, ee.key));
+                  (unifiable(e.key, ee.key) || is_member(e.key, ee.key)));
         });
       if (it != sequence.end())
         return MatchResult::no_match;
       ++e;
     }
-    else if (unifiable(se, ee)) {
+    else if (unifiable_event(se, ee)) {
       // direct match
       ++s;
       ++e;
@@ -91,7 +152,8 @@ MatchResult MatchKeySequence::operator()(const KeySequence& expression,
       const auto it = std::find_if(cbegin(m_async), cend(m_async),
         [&](const KeyEvent& e) {
           return ((e.state == async_state || e.state == ee.state) &&
-            se.key == e.key);
+            (se.key == e.key ||
+             (is_logical_key(e.key) && unifiable_key(se.key, e.key))));
         });
       if (it != cend(m_async))
         m_async.erase(it);
@@ -106,7 +168,7 @@ MatchResult MatchKeySequence::operator()(const KeySequence& expression,
       auto it = std::find_if(begin(m_async), end(m_async),
         [&](const KeyEvent& e) {
           return (e.state == async_state &&
-            unifiable(se.key, e.key));
+            unifiable_key(se.key, e.key));
         });
 
       if (it != end(m_async)) {
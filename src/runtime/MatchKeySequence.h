@@ -6,13 +6,32 @@ enum class MatchResult { no_match, might_match, match };
 
 class MatchKeySequence {
 public:
+  void set_logical_keys(const LogicalKeys& logical_keys);
+
   MatchResult operator()(
     const KeySequence& expression,
     ConstKeySequenceRange sequence,
     std::vector<Key>* any_key_matches,
     KeyEvent* input_timeout_event) const;
 
+  // the key a logical key was matched with in the last call
+  Key get_logical_key_match(Key logical_key) const;
+
 private:
-  // temporary buffer
+  // a bit per key code modulo 64, to quickly reject non-members
+  struct LogicalKey {
+    uint64_t bits;
+    std::vector<Key> keys;
+  };
+
+  bool is_member(Key key, Key logical_key) const;
+  bool unifiable_key(Key sequence_key, Key expression_key) const;
+  bool unifiable_event(const KeyEvent& se, const KeyEvent& ee) const;
+
+  std::vector<LogicalKey> m_logical_keys;
+
+  // temporary buffers
   mutable std::vector<KeyEvent> m_async;
+  // logical keys are bound to the key they first matched
+  mutable std::vector<std::pair<Key, Key>> m_logical_key_matches;
 };
@@ -51,19 +51,37 @@ namespace {
     return contexts;
   }
 
-  bool has_mouse_mappings(const KeySequence& sequence) {
+  bool has_mouse_mappings(const KeySequence& sequence,
+      const LogicalKeys& logical_keys) {
     return std::any_of(begin(sequence), end(sequence),
-      [](const KeyEvent& event) { return is_mouse_button(event.key); });
+      [&](const KeyEvent& event) {
+        if (is_logical_key(event.key)) {
+          const auto index = static_cast<size_t>(*event.key - *Key::first_logical);
+          return (index < logical_keys.size() &&
+            std::any_of(logical_keys[index].begin(), logical_keys[index].end(),
+              &is_mouse_button));
+        }
+        return is_mouse_button(event.key);
+      });
   }
 
-  bool has_mouse_mappings(const std::vector<Stage::Context>& contexts) {
+  bool has_mouse_mappings(const std::vector<Stage::Context>& contexts,
+      const std::vector<KeySequence>& sequences,
+      const LogicalKeys& logical_keys) {
     for (const auto& context : contexts)
       for (const auto& input : context.inputs)
-        if (has_mouse_mappings(input.input))
+        if (has_mouse_mappings(sequences[input.input], logical_keys))
           return true;
     return false;
   }
 
+  const auto max_active_context_sets = size_t{ 16 };
+
+  void trim_context_bits(Stage::ContextBits& bits) {
+    while (!bits.empty() && !bits.back())
+      bits.pop_back();
+  }
+
   const KeyEvent* find_last_down_event(ConstKeySequenceRange sequence) {
     auto last = std::add_pointer_t<const KeyEvent>{ };
     for (const auto& event : sequence)
@@ -74,9 +92,14 @@ namespace {
   }
 } // namespace
 
-Stage::Stage(std::vector<Context> contexts)
+Stage::Stage(std::vector<Context> contexts, std::vector<KeySequence> sequences,
+    const LogicalKeys& logical_keys)
   : m_contexts(sort_command_outputs(std::move(contexts))),
-    m_has_mouse_mappings(::has_mouse_mappings(m_contexts)) {
+    m_sequences(std::move(sequences)),
+    m_has_mouse_mappings(::has_mouse_mappings(m_contexts, m_sequences,
+      logical_keys)),
+    m_active_context_sets(1) {
+  m_match.set_logical_keys(logical_keys);
 }
 
 bool Stage::is_clear() const {
@@ -94,7 +117,7 @@ void Stage::evaluate_device_filters(const std::vector<std::string>& device_names
       if (is_regex(context.device_filter)) {
         const auto regex = parse_regex(context.device_filter);
         for (const auto& device_name : device_names) {
-          if (std::regex_search(device_name, regex))
+          if (regex.search(device_name))
             context.matching_device_bits |= bit;
           bit <<= 1;
         }
@@ -116,10 +139,63 @@ bool Stage::device_matches_filter(const Context& context, int device_index) cons
 void Stage::set_active_contexts(const std::vector<int> &indices) {
   // order of active contexts is relevant
   assert(std::is_sorted(begin(indices), end(indices)));
-  for (auto i : indices)
+
+  auto bits = ContextBits();
+  for (auto i : indices) {
     assert(i >= 0 && i < static_cast<int>(m_contexts.size()));
+    const auto word = static_cast<size_t>(i) / 64;
+    if (word >= bits.size())
+      bits.resize(word + 1);
+    bits[word] |= uint64_t{ 1 } << (i % 64);
+  }
+  set_active_context_bits(std::move(bits));
+}
 
-  m_active_contexts = indices;
+void Stage::set_active_context_bits(ContextBits bits) {
+  trim_context_bits(bits);
+
+  const auto it = std::find_if(begin(m_active_context_sets),
+    end(m_active_context_sets),
+    [&](const ActiveContextSet& set) { return set.bits == bits; });
+  if (it != end(m_active_context_sets)) {
+    m_active_context_set = static_cast<size_t>(
+      std::distance(begin(m_active_context_sets), it));
+    it->last_used = ++m_active_context_set_usage;
+    return;
+  }
+
+  // replace least recently used set
+  if (m_active_context_sets.size() >= max_active_context_sets) {
+    const auto lru = std::min_element(begin(m_active_context_sets),
+      end(m_active_context_sets),
+      [](const ActiveContextSet& a, const ActiveContextSet& b) {
+        return a.last_used < b.last_used;
+      });
+    m_active_context_set = static_cast<size_t>(
+      std::distance(begin(m_active_context_sets), lru));
+  }
+  else {
+    m_active_context_set = m_active_context_sets.size();
+    m_active_context_sets.emplace_back();
+  }
+
+  auto& set = m_active_context_sets[m_active_context_set];
+  set.contexts.clear();
+  set.command_output_contexts.clear();
+  const auto context_count = static_cast<int>(m_contexts.size());
+  for (auto i = 0; i < context_count; ++i)
+    if (static_cast<size_t>(i) / 64 < bits.size() &&
+        ((bits[i / 64] >> (i % 64)) & 1))
+      set.contexts.push_back(i);
+  for (auto it = set.contexts.rbegin(); it != set.contexts.rend(); ++it)
+    if (!m_contexts[*it].command_outputs.empty())
+      set.command_output_contexts.push_back(*it);
+  set.bits = std::move(bits);
+  set.last_used = ++m_active_context_set_usage;
+}
+
+auto Stage::active_context_set() const -> const ActiveContextSet& {
+  return m_active_context_sets[m_active_context_set];
 }
 
 void Stage::advance_exit_sequence(const KeyEvent& event) {
@@ -169,17 +245,17 @@ void Stage::validate_state(const std::function<bool(Key)>& is_down) {
     end(m_output_down));
 }
 
-const KeySequence* Stage::find_output(const Context& context, int output_index) const {
+auto Stage::find_output(const Context& context, int output_index) const
+    -> const SequenceIndex* {
   if (output_index >= 0) {
     assert(output_index < static_cast<int>(context.outputs.size()));
     return &context.outputs[output_index];
   }
 
   // search for last override of command output
-  for (auto i = static_cast<int>(m_active_contexts.size()) - 1; i >= 0; --i) {
+  for (auto index : active_context_set().command_output_contexts) {
     // binary search for command outputs of context
-    const auto& command_outputs =
-      m_contexts[m_active_contexts[i]].command_outputs;
+    const auto& command_outputs = m_contexts[index].command_outputs;
     const auto it = std::lower_bound(
       command_outputs.rbegin(), command_outputs.rend(), output_index,
       [](const CommandOutput& a, int index) { return a.index < index; });
@@ -189,16 +265,16 @@ const KeySequence* Stage::find_output(const Context& context, int output_index)
   return nullptr;
 }
 
-std::pair<MatchResult, const KeySequence*> Stage::match_input(
+std::pair<MatchResult, const Stage::SequenceIndex*> Stage::match_input(
     ConstKeySequenceRange sequence, int device_index, bool accept_might_match) {
-  for (auto i : m_active_contexts) {
+  for (auto i : active_context_set().contexts) {
     const auto& context = m_contexts[i];
     if (!device_matches_filter(context, device_index))
       continue;
 
     for (const auto& input : context.inputs) {
       auto input_timeout_event = KeyEvent{ };
-      const auto result = m_match(input.input, sequence,
+      const auto result = m_match(m_sequences[input.input], sequence,
         &m_any_key_matches, &input_timeout_event);
 
       if (accept_might_match && result == MatchResult::might_match) {
@@ -340,7 +416,7 @@ void Stage::apply_input(const KeyEvent event, int device_index) {
             it != cend(m_sequence) && it->state != KeyState::Up)
           trigger = m_current_timeout->trigger;
 
-      apply_output(*output, trigger);
+      apply_output(m_sequences[*output], trigger);
 
       // release new output when triggering input was released
       if (event.state == KeyState::Up)
@@ -383,6 +459,11 @@ void Stage::apply_output(const KeySequence& expression, Key trigger) {
       for (auto key : m_any_key_matches)
         update_output({ key, event.state }, trigger);
     }
+    else if (is_logical_key(event.key)) {
+      // output the key the logical key was matched with in input
+      if (const auto key = m_match.get_logical_key_match(event.key); key != Key::none)
+        update_output({ key, event.state }, trigger);
+    }
     else {
       update_output(event, trigger);
     }
@@ -6,28 +6,36 @@
 
 class Stage {
 public:
+  // identical key sequences are stored once and referenced by index
+  using SequenceIndex = uint32_t;
+
   struct Input {
-    KeySequence input;
+    SequenceIndex input;
     // positive for direct-, negative for command output
     int output_index;
   };
 
   struct CommandOutput {
-    KeySequence output;
+    SequenceIndex output;
     int index;
   };
 
   struct Context {
     std::vector<Input> inputs;
-    std::vector<KeySequence> outputs;
+    std::vector<SequenceIndex> outputs;
     std::vector<CommandOutput> command_outputs;
     std::string device_filter;
     uint64_t matching_device_bits = ~uint64_t{ };
   };
 
-  explicit Stage(std::vector<Context> contexts);
+  // one bit per context index
+  using ContextBits = std::vector<uint64_t>;
+
+  Stage(std::vector<Context> contexts, std::vector<KeySequence> sequences,
+    const LogicalKeys& logical_keys = { });
 
   const std::vector<Context>& contexts() const { return m_contexts; }
+  const std::vector<KeySequence>& sequences() const { return m_sequences; }
   bool has_mouse_mappings() const { return m_has_mouse_mappings; }
 
   bool is_clear() const;
@@ -35,6 +43,7 @@ public:
   bool is_output_down() const { return !m_output_down.empty(); }
   void evaluate_device_filters(const std::vector<std::string>& device_names);
   void set_active_contexts(const std::vector<int>& indices);
+  void set_active_context_bits(ContextBits bits);
   KeySequence update(KeyEvent event, int device_index);
   void reuse_buffer(KeySequence&& buffer);
   void validate_state(const std::function<bool(Key)>& is_down);
@@ -42,9 +51,10 @@ public:
 
 private:
   void advance_exit_sequence(const KeyEvent& event);
-  const KeySequence* find_output(const Context& context, int output_index) const;
+  // the address of the output's index identifies the mapping
+  const SequenceIndex* find_output(const Context& context, int output_index) const;
   bool device_matches_filter(const Context& context, int device_index) const;
-  std::pair<MatchResult, const KeySequence*> match_input(
+  std::pair<MatchResult, const SequenceIndex*> match_input(
     ConstKeySequenceRange sequence, int device_index, 
     bool accept_might_match);
   void apply_input(KeyEvent event, int device_index);
@@ -54,9 +64,22 @@ private:
   void update_output(const KeyEvent& event, Key trigger);
   void finish_sequence(ConstKeySequenceRange sequence);
 
+  // recently active context sets, so switching between them is cheap
+  struct ActiveContextSet {
+    ContextBits bits;
+    std::vector<int> contexts;
+    // contexts with command outputs in reverse order
+    std::vector<int> command_output_contexts;
+    uint64_t last_used;
+  };
+  const ActiveContextSet& active_context_set() const;
+
   std::vector<Context> m_contexts;
+  std::vector<KeySequence> m_sequences;
   bool m_has_mouse_mappings{ };
-  std::vector<int> m_active_contexts;
+  std::vector<ActiveContextSet> m_active_context_sets;
+  size_t m_active_context_set{ };
+  uint64_t m_active_context_set_usage{ };
   MatchKeySequence m_match;
   size_t m_exit_sequence_position{ };
 
@@ -76,7 +99,7 @@ private:
 
   struct CurrentTimeout : KeyEvent {
     Key trigger;
-    const KeySequence* matched_output;
+    const SequenceIndex* matched_output;
     bool not_exceeded;
   };
   std::optional<CurrentTimeout> m_current_timeout;
@@ -1,65 +1,161 @@
 
 #include "ClientPort.h"
-#include "runtime/Stage.h"
+#include "common/output.h"
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+#if !defined(_WIN32)
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
 
 namespace {
-  KeySequence read_key_sequence(Deserializer& d) {
-    auto sequence = KeySequence();
-    auto size = d.read<uint32_t>();
-    for (auto i = 0u; i < size; ++i) {
-      auto& event = sequence.emplace_back();
-      d.read(&event.key);
-      d.read(&event.data);
+  const auto new_context = int32_t{ -1 };
+
+  // key events are transferred in their memory representation
+  static_assert(sizeof(KeyEvent) == sizeof(Key) + sizeof(KeyEvent::data));
+
+#if !defined(_WIN32)
+  // maps the sealed memory file passed by the client
+  Deserializer map_config_memfd(int fd, uint64_t size) {
+    const auto required_seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+    const auto seals = ::fcntl(fd, F_GET_SEALS);
+    struct stat st{ };
+    if (seals < 0 || (seals & required_seals) != required_seals ||
+        ::fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != size ||
+        size == 0) {
+      error("Received invalid configuration memory file");
+      return { };
     }
-    return sequence;
+    const auto data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      error("Mapping configuration memory file failed");
+      return { };
+    }
+    const auto mapping = std::shared_ptr<const void>(data,
+      [size](const void* data) { ::munmap(const_cast<void*>(data), size); });
+    return Deserializer(mapping, static_cast<const char*>(data), size);
   }
+#endif
 
-  std::unique_ptr<Stage> read_config(Deserializer& d) {
-    // receive contexts
-    auto contexts = std::vector<Stage::Context>();
+  // key sequences are read as indices into the pool of the message
+  void read_context(Deserializer& d, Stage::Context& context) {
+    // inputs
     auto count = d.read<uint32_t>();
-    contexts.resize(count);
-    for (auto& context : contexts) {
-      // inputs
-      count = d.read<uint32_t>();
-      context.inputs.resize(count);
-      for (auto& input : context.inputs) {
-        input.input = read_key_sequence(d);
-        input.output_index = d.read<int32_t>();
-      }
-
-      // outputs
-      count = d.read<uint32_t>();
-      context.outputs.resize(count);
-      for (auto& output : context.outputs) {
-        output = read_key_sequence(d);
-      }
-
-      // command outputs
-      count = d.read<uint32_t>();
-      context.command_outputs.resize(count);
-      for (auto& command : context.command_outputs) {
-        command.output = read_key_sequence(d);
-        command.index = d.read<int32_t>();
-      }
-
-      // device filter
-      context.device_filter.resize(d.read<uint32_t>(), ' ');
-      d.read(context.device_filter.data(), context.device_filter.size());
+    context.inputs.resize(count);
+    for (auto& input : context.inputs) {
+      input.input = d.read<uint32_t>();
+      input.output_index = d.read<int32_t>();
     }
-    return std::make_unique<Stage>(std::move(contexts));
+
+    // outputs
+    count = d.read<uint32_t>();
+    context.outputs.resize(count);
+    for (auto& output : context.outputs) {
+      output = d.read<uint32_t>();
+    }
+
+    // command outputs
+    count = d.read<uint32_t>();
+    context.command_outputs.resize(count);
+    for (auto& command : context.command_outputs) {
+      command.output = d.read<uint32_t>();
+      command.index = d.read<int32_t>();
+    }
+
+    // device filter
+    context.device_filter.resize(d.read<uint32_t>(), ' ');
+    d.read(context.device_filter.data(), context.device_filter.size());
   }
 
-  void read_active_contexts(Deserializer& d, std::vector<int>* indices) {
-    indices->clear();
-    const auto count = d.read<uint32_t>();
-    for (auto i = 0u; i < count; ++i)
-      indices->push_back(static_cast<int>(d.read<uint32_t>()));
+  template<typename F> // bool(Stage::SequenceIndex&)
+  bool for_each_sequence_index(Stage::Context& context, F&& function) {
+    for (auto& input : context.inputs)
+      if (!function(input.input))
+        return false;
+    for (auto& output : context.outputs)
+      if (!function(output))
+        return false;
+    for (auto& command : context.command_outputs)
+      if (!function(command.output))
+        return false;
+    return true;
+  }
+
+  // interns the key sequences of the reused and the received contexts
+  // into a new pool, which no longer contains unreferenced sequences
+  class KeySequencePool {
+  public:
+    KeySequencePool(std::vector<KeySequence>* base_sequences,
+                    std::vector<KeySequence>* new_sequences)
+      : m_base{ base_sequences, { } }, m_new{ new_sequences, { } } {
+      m_base.indices.resize(base_sequences->size(), none);
+      m_new.indices.resize(new_sequences->size(), none);
+    }
+
+    bool is_valid(Stage::Context& context, bool reused) const {
+      const auto& source = (reused ? m_base : m_new);
+      return for_each_sequence_index(context,
+        [&](Stage::SequenceIndex index) {
+          return (index < source.sequences->size());
+        });
+    }
+
+    void remap(Stage::Context& context, bool reused) {
+      auto& source = (reused ? m_base : m_new);
+      for_each_sequence_index(context, [&](Stage::SequenceIndex& index) {
+        auto& remapped = source.indices[index];
+        if (remapped == none) {
+          auto& sequence = (*source.sequences)[index];
+          const auto [it, inserted] = m_indices.emplace(sequence,
+            static_cast<Stage::SequenceIndex>(m_sequences.size()));
+          if (inserted)
+            m_sequences.push_back(std::move(sequence));
+          remapped = it->second;
+        }
+        index = remapped;
+        return true;
+      });
+    }
+
+    std::vector<KeySequence> release() { return std::move(m_sequences); }
+
+  private:
+    static constexpr auto none =
+      std::numeric_limits<Stage::SequenceIndex>::max();
+
+    struct Source {
+      std::vector<KeySequence>* sequences;
+      std::vector<Stage::SequenceIndex> indices;
+    };
+    Source m_base;
+    Source m_new;
+    std::unordered_map<KeySequence, Stage::SequenceIndex,
+      KeySequenceHash> m_indices;
+    std::vector<KeySequence> m_sequences;
+  };
+
+  void read_active_contexts(Deserializer& d, std::vector<uint64_t>* bits) {
+    bits->resize(d.read<uint32_t>());
+    d.read(bits->data(), bits->size() * sizeof(uint64_t));
   }
 } // namespace
 
 ClientPort::ClientPort() = default;
-ClientPort::~ClientPort() = default;
+
+ClientPort::~ClientPort() {
+  if (m_compile_thread.joinable()) {
+    {
+      auto lock = std::lock_guard(m_compile_mutex);
+      m_shutdown_compile_thread = true;
+    }
+    m_compile_condition.notify_all();
+    m_compile_thread.join();
+  }
+}
 
 Connection::Socket ClientPort::socket() const {
   return (m_connection ? m_connection->socket() : Connection::invalid_socket);
@@ -85,20 +181,219 @@ bool ClientPort::accept() {
 void ClientPort::disconnect() {
   if (m_connection)
     m_connection->disconnect();
+
+  // discard configuration of previous connection
+  auto lock = std::lock_guard(m_compile_mutex);
+  m_configs_to_compile.clear();
+  m_compiled = false;
+  m_compiled_stage.reset();
+  m_clear_contexts = true;
+  ++m_config_generation;
+  m_config_pending = false;
 }
 
 std::unique_ptr<Stage> ClientPort::read_config(Deserializer& d) {
-  return ::read_config(d);
+  read_config_async(d);
+
+  auto lock = std::unique_lock(m_compile_mutex);
+  m_compile_condition.wait(lock, [&]() { return m_compiled; });
+  lock.unlock();
+
+  auto compile_time = Duration();
+  return take_compiled_stage(&compile_time);
+}
+
+void ClientPort::read_config_async(Deserializer& d) {
+  if (!m_compile_thread.joinable())
+    m_compile_thread = std::thread(&ClientPort::compile_thread, this);
+
+  auto config = read_config_data(d);
+  {
+    auto lock = std::lock_guard(m_compile_mutex);
+    m_configs_to_compile.push_back(std::move(config));
+    m_compiled = false;
+    m_compiled_stage.reset();
+    ++m_config_generation;
+  }
+  m_config_pending = true;
+  m_compile_condition.notify_all();
+}
+
+Deserializer ClientPort::read_config_data(Deserializer& d) {
+  const auto transfer = d.read<ConfigTransfer>();
+#if !defined(_WIN32)
+  if (transfer == ConfigTransfer::memfd) {
+    const auto size = d.read<uint64_t>();
+    const auto fd = m_connection->take_received_fd();
+    if (fd == Connection::invalid_socket) {
+      error("Receiving configuration memory file failed");
+      return { };
+    }
+    auto mapped = map_config_memfd(fd, size);
+    ::close(fd);
+    return mapped;
+  }
+#endif
+  if (transfer != ConfigTransfer::message)
+    return { };
+  return d.detach_remaining();
 }
 
-const std::vector<int>& ClientPort::read_active_contexts(Deserializer& d) {
-  ::read_active_contexts(d, &m_active_context_indices);
-  return m_active_context_indices;
+std::unique_ptr<Stage> ClientPort::get_compiled_config(Duration* compile_time) {
+  if (!m_config_pending)
+    return nullptr;
+  return take_compiled_stage(compile_time);
+}
+
+std::unique_ptr<Stage> ClientPort::take_compiled_stage(Duration* compile_time) {
+  auto lock = std::unique_lock(m_compile_mutex);
+  if (!m_compiled)
+    return nullptr;
+  m_compiled = false;
+  m_config_pending = false;
+  *compile_time = m_compile_time;
+  auto stage = std::move(m_compiled_stage);
+  lock.unlock();
+
+  if (!stage) {
+    verbose("Requesting complete configuration");
+    send_configuration_request();
+  }
+  return stage;
+}
+
+ClientPort::ApplyResult ClientPort::apply_config(Deserializer& d) {
+  if (!d.can_read(3 * sizeof(uint32_t)))
+    return ApplyResult::invalid;
+  const auto base_version = d.read<uint32_t>();
+  const auto version = d.read<uint32_t>();
+  auto contexts = std::vector<Stage::Context>(d.read<uint32_t>());
+  auto reused = std::vector<bool>(contexts.size());
+  for (auto i = 0u; i < contexts.size(); ++i) {
+    const auto source = d.read<int32_t>();
+    if (source == new_context) {
+      read_context(d, contexts[i]);
+      continue;
+    }
+    // reuse context of base configuration
+    if (base_version != m_config_version)
+      return ApplyResult::outdated_base;
+    if (source < 0 || source >= static_cast<int32_t>(m_contexts.size()))
+      return ApplyResult::invalid;
+    contexts[i] = m_contexts[source];
+    reused[i] = true;
+  }
+
+  // key sequences of the received contexts
+  const auto sequence_count = d.read<uint32_t>();
+  if (sequence_count && !d.can_read(sequence_count * sizeof(uint32_t)))
+    return ApplyResult::invalid;
+  auto sequences = std::vector<KeySequence>(sequence_count);
+  for (auto& sequence : sequences)
+    d.read_array(&sequence);
+
+  // logical keys
+  const auto logical_key_count = d.read<uint32_t>();
+  if (logical_key_count &&
+      !d.can_read(logical_key_count * sizeof(uint32_t)))
+    return ApplyResult::invalid;
+  auto logical_keys = LogicalKeys(logical_key_count);
+  for (auto& keys : logical_keys)
+    d.read_array(&keys);
+
+  // the base sequences are moved to the new pool, so validate first
+  auto pool = KeySequencePool(&m_sequences, &sequences);
+  for (auto i = 0u; i < contexts.size(); ++i)
+    if (!pool.is_valid(contexts[i], reused[i]))
+      return ApplyResult::invalid;
+  for (auto i = 0u; i < contexts.size(); ++i)
+    pool.remap(contexts[i], reused[i]);
+
+  m_contexts = std::move(contexts);
+  m_sequences = pool.release();
+  m_logical_keys = std::move(logical_keys);
+  m_config_version = version;
+  return ApplyResult::applied;
+}
+
+void ClientPort::compile_thread() {
+  auto lock = std::unique_lock(m_compile_mutex);
+  for (;;) {
+    m_compile_condition.wait(lock, [&]() {
+      return m_shutdown_compile_thread || !m_configs_to_compile.empty();
+    });
+    if (m_shutdown_compile_thread)
+      return;
+
+    if (std::exchange(m_clear_contexts, false)) {
+      m_contexts.clear();
+      m_sequences.clear();
+      m_logical_keys.clear();
+      m_config_version = { };
+    }
+    auto d = std::move(m_configs_to_compile.front());
+    m_configs_to_compile.pop_front();
+    const auto generation = m_config_generation;
+    lock.unlock();
+
+    // every update is applied, but only the last one is compiled. the stage
+    // is not patched in place, the input thread keeps using the current one
+    // until the new one is swapped in while no key is down
+    const auto start = Clock::now();
+    auto stage = std::unique_ptr<Stage>();
+    const auto result = apply_config(d);
+    const auto applied = (result == ApplyResult::applied);
+    if (result == ApplyResult::invalid)
+      error("Received invalid configuration");
+    if (!applied)
+      m_config_version = { };
+
+    lock.lock();
+    if (applied && !m_configs_to_compile.empty())
+      continue;
+    lock.unlock();
+
+    if (applied)
+      stage = std::make_unique<Stage>(m_contexts, m_sequences,
+        m_logical_keys);
+    const auto compile_time = Duration(Clock::now() - start);
+
+    lock.lock();
+    // only publish when it was not superseded in the meantime
+    if (generation == m_config_generation) {
+      m_compiled = true;
+      m_compiled_stage = std::move(stage);
+      m_compile_time = compile_time;
+      m_compile_condition.notify_all();
+    }
+  }
+}
+
+const std::vector<uint64_t>& ClientPort::read_active_contexts(Deserializer& d) {
+  ::read_active_contexts(d, &m_active_context_bits);
+  return m_active_context_bits;
 }
 
 bool ClientPort::send_triggered_action(int action) {
   return m_connection && m_connection->send_message(
     [&](Serializer& s) {
+      s.write(MessageType::triggered_action);
       s.write(static_cast<uint32_t>(action));
-    });
+      s.write(static_cast<uint64_t>(Clock::now().time_since_epoch().count()));
+    }, Connection::SendPolicy::drop);
+}
+
+bool ClientPort::send_configuration_request() {
+  return m_connection && m_connection->send_message(
+    [&](Serializer& s) {
+      s.write(MessageType::configuration_request);
+    }, Connection::SendPolicy::coalesce);
+}
+
+bool ClientPort::flush_send_queue() {
+  return !m_connection || m_connection->flush_send_queue();
+}
+
+bool ClientPort::has_pending_send() const {
+  return m_connection && m_connection->has_pending_send();
 }
@@ -2,16 +2,38 @@
 
 #include <memory>
 #include <vector>
+#include <deque>
 #include <optional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "common/MessageType.h"
 #include "common/Connection.h"
-
-class Stage;
+#include "runtime/Stage.h"
 
 class ClientPort {
 private:
   std::unique_ptr<Connection> m_connection;
-  std::vector<int> m_active_context_indices;
+  std::vector<uint64_t> m_active_context_bits;
+
+  // background configuration compilation
+  std::thread m_compile_thread;
+  std::mutex m_compile_mutex;
+  std::condition_variable m_compile_condition;
+  std::deque<Deserializer> m_configs_to_compile;
+  bool m_compiled{ };
+  std::unique_ptr<Stage> m_compiled_stage;
+  Duration m_compile_time{ };
+  uint32_t m_config_generation{ };
+  bool m_clear_contexts{ };
+  bool m_shutdown_compile_thread{ };
+  bool m_config_pending{ };
+
+  // contexts of last received configuration, only accessed by compile thread
+  std::vector<Stage::Context> m_contexts;
+  std::vector<KeySequence> m_sequences;
+  LogicalKeys m_logical_keys;
+  uint32_t m_config_version{ };
 
 public:
   ClientPort();
@@ -31,6 +53,23 @@ public:
       timeout, std::forward<F>(deserialize));
   }
   std::unique_ptr<Stage> read_config(Deserializer& d);
-  const std::vector<int>& read_active_contexts(Deserializer& d);
+  void read_config_async(Deserializer& d);
+  bool is_config_pending() const { return m_config_pending; }
+  std::unique_ptr<Stage> get_compiled_config(Duration* compile_time);
+  const std::vector<uint64_t>& read_active_contexts(Deserializer& d);
+  const std::vector<uint64_t>& active_contexts() const { return m_active_context_bits; }
   bool send_triggered_action(int action);
+
+  // sending never blocks, messages are queued while client does not read
+  bool flush_send_queue();
+  bool has_pending_send() const;
+
+private:
+  enum class ApplyResult { applied, outdated_base, invalid };
+
+  void compile_thread();
+  Deserializer read_config_data(Deserializer& d);
+  ApplyResult apply_config(Deserializer& d);
+  std::unique_ptr<Stage> take_compiled_stage(Duration* compile_time);
+  bool send_configuration_request();
 };
@@ -9,9 +9,12 @@
 #include "runtime/Timeout.h"
 #include "common/output.h"
 #include <linux/uinput.h>
+#include <bitset>
 
 namespace {
   const auto uinput_device_name = "Keymapper";
+  const auto config_poll_interval = std::chrono::milliseconds(10);
+  const auto send_poll_interval = std::chrono::milliseconds(10);
 
   ClientPort g_client;
   std::unique_ptr<Stage> g_stage;
@@ -27,6 +30,13 @@ namespace {
   KeyEvent g_last_key_event;
   int g_last_device_index;
 
+  int count_bits(const std::vector<uint64_t>& bits) {
+    auto count = 0;
+    for (const auto& word : bits)
+      count += static_cast<int>(std::bitset<64>(word).count());
+    return count;
+  }
+
   void evaluate_device_filters() {
     g_stage->evaluate_device_filters(g_grabbed_devices.grabbed_device_names());
   }
@@ -35,28 +45,47 @@ namespace {
     return g_client.read_messages(timeout, [&](Deserializer& d) {
       const auto message_type = d.read<MessageType>();
       if (message_type == MessageType::configuration) {
-        const auto prev_stage = std::move(g_stage);
-        g_stage = g_client.read_config(d);
         verbose("Received configuration");
-
-        if (prev_stage &&
-            prev_stage->has_mouse_mappings() != g_stage->has_mouse_mappings()) {
-          verbose("Mouse usage in configuration changed");
-          g_stage.reset();
+        if (g_stage) {
+          // do not stall input processing while compiling
+          g_client.read_config_async(d);
         }
         else {
-          evaluate_device_filters();
+          g_stage = g_client.read_config(d);
+          if (g_stage)
+            evaluate_device_filters();
         }
       }
       else if (message_type == MessageType::active_contexts) {
         const auto& contexts = g_client.read_active_contexts(d);
-        verbose("Received contexts (%d)", contexts.size());
-        if (g_stage)
-          g_stage->set_active_contexts(contexts);
+        verbose("Received contexts (%d)", count_bits(contexts));
+        // otherwise they are set when the new stage is applied
+        if (g_stage && !g_client.is_config_pending())
+          g_stage->set_active_context_bits(contexts);
       }
     });
   }
 
+  bool apply_compiled_config() {
+    auto compile_time = Duration();
+    auto stage = g_client.get_compiled_config(&compile_time);
+    if (!stage)
+      return true;
+
+    verbose("Applying configuration (compiled in %.1fms)",
+      std::chrono::duration<double, std::milli>(compile_time).count());
+
+    if (g_stage->has_mouse_mappings() != stage->has_mouse_mappings()) {
+      verbose("Mouse usage in configuration changed");
+      g_stage.reset();
+      return false;
+    }
+    g_stage = std::move(stage);
+    g_stage->set_active_context_bits(g_client.active_contexts());
+    evaluate_device_filters();
+    return true;
+  }
+
   bool read_initial_config() {
     while (!g_stage) {
       if (!read_client_messages()) {
@@ -167,6 +196,10 @@ namespace {
         timeout = std::min(timeout, Duration{ g_flush_scheduled_at.value() - now });
       if (g_input_timeout_start)
         timeout = std::min(timeout, Duration{ g_input_timeout_start.value() + g_input_timeout - now });
+      if (g_client.is_config_pending())
+        timeout = std::min(timeout, Duration{ config_poll_interval });
+      if (g_client.has_pending_send())
+        timeout = std::min(timeout, Duration{ send_poll_interval });
 
       const auto [succeeded, input] = g_grabbed_devices.read_input_event(timeout);
       if (!succeeded) {
@@ -205,10 +238,16 @@ namespace {
         }
       }
 
+      // send messages the client did not read yet
+      if (!g_client.flush_send_queue()) {
+        verbose("Connection to keymapper reset");
+        return true;
+      }
+
       // let client update configuration and context
       if (!g_stage->is_output_down())
         if (!read_client_messages(Duration::zero()) ||
-            !g_stage) {
+            !apply_compiled_config()) {
           verbose("Connection to keymapper reset");
           return true;
         }
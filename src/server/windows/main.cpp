@@ -25,7 +25,7 @@ namespace {
   ButtonDebouncer g_button_debouncer;
   std::unique_ptr<Stage> g_stage;
   std::unique_ptr<Stage> g_new_stage;
-  const std::vector<int>* g_new_active_contexts;
+  const std::vector<uint64_t>* g_new_active_contexts;
   HHOOK g_keyboard_hook;
   HHOOK g_mouse_hook;
   bool g_sending_key;
@@ -394,7 +394,7 @@ namespace {
   bool accept() {
     if (!g_client.accept() ||
         WSAAsyncSelect(g_client.socket(), g_window,
-          WM_APP_CLIENT_MESSAGE, (FD_READ | FD_CLOSE)) != 0) {
+          WM_APP_CLIENT_MESSAGE, (FD_READ | FD_WRITE | FD_CLOSE)) != 0) {
       error("Connecting to keymapper failed");
       return false;
     }
@@ -418,11 +418,11 @@ namespace {
         validate_state();
       }
       else if (message_type == MessageType::configuration) {
+        // an update based on an outdated version is not an error, the
+        // complete configuration is requested and the current stage kept
         g_new_stage = g_client.read_config(d);
-        if (!g_new_stage)
-          return error("Receiving configuration failed");
-
-        verbose("Configuration received");
+        if (g_new_stage)
+          verbose("Configuration received");
       }
     });
   }
@@ -436,7 +436,7 @@ namespace {
       g_stage = std::move(g_new_stage);
 
     if (g_new_active_contexts) {
-      g_stage->set_active_contexts(*g_new_active_contexts);
+      g_stage->set_active_context_bits(*g_new_active_contexts);
       g_new_active_contexts = nullptr;
 
       // reinsert hook in front of callchain
@@ -455,6 +455,10 @@ namespace {
         if (lparam == FD_ACCEPT) {
           accept();
         }
+        else if (lparam == FD_WRITE) {
+          if (!g_client.flush_send_queue())
+            g_client.disconnect();
+        }
         else if (lparam == FD_READ) {
           if (handle_client_message()) {
             apply_updates();
@@ -8,6 +8,7 @@
 #include "config/string_iteration.h"
 #include "runtime/Key.h"
 #include "runtime/Timeout.h"
+#include <unordered_map>
 
 namespace {
   std::ostream& operator<<(std::ostream& os, const KeyEvent& event) {
@@ -28,6 +29,9 @@ namespace {
     else if (is_action_key(event.key)) {
       os << "Action" << (*event.key - *Key::first_action);
     }
+    else if (is_logical_key(event.key)) {
+      os << "Logical" << (*event.key - *Key::first_logical);
+    }
     else if (event.key == Key::timeout) {
       os << timeout_to_milliseconds(event.timeout).count() << "ms";
     }
@@ -105,16 +109,30 @@ Stage create_stage(const char* string) {
   auto stream = std::stringstream(string);
   auto config = parse_config(stream);
 
+  // intern identical key sequences
+  auto sequences = std::vector<KeySequence>();
+  auto sequence_indices = std::unordered_map<KeySequence,
+    Stage::SequenceIndex, KeySequenceHash>();
+  const auto add_sequence = [&](KeySequence& sequence) {
+    const auto [it, inserted] = sequence_indices.emplace(sequence,
+      static_cast<Stage::SequenceIndex>(sequences.size()));
+    if (inserted)
+      sequences.push_back(std::move(sequence));
+    return it->second;
+  };
+
   auto contexts = std::vector<Stage::Context>();
   for (auto& config_context : config.contexts) {
     auto& context = contexts.emplace_back();
-    for (const auto& input : config_context.inputs)
-      context.inputs.push_back({ std::move(input.input), input.output_index });
-    context.outputs = std::move(config_context.outputs);
-    for (const auto& output : config_context.command_outputs)
-      context.command_outputs.push_back({ std::move(output.output), output.index });
+    for (auto& input : config_context.inputs)
+      context.inputs.push_back({ add_sequence(input.input), input.output_index });
+    for (auto& output : config_context.outputs)
+      context.outputs.push_back(add_sequence(output));
+    for (auto& output : config_context.command_outputs)
+      context.command_outputs.push_back({ add_sequence(output.output), output.index });
   }
-  auto stage = Stage(std::move(contexts));
+  auto stage = Stage(std::move(contexts), std::move(sequences),
+    config.logical_keys);
 
   // automatically activate all contexts
   auto active_contexts = std::vector<int>();
@@ -1,5 +1,6 @@
 
 #include "test.h"
+#include "config/get_key_name.h"
 
 TEST_CASE("Input Expression", "[ParseKeySequence]") {
   // Empty
@@ -338,3 +339,30 @@ TEST_CASE("Output Expression", "[ParseKeySequence]") {
 }
 
 //--------------------------------------------------------------------
+
+TEST_CASE("Key names", "[ParseKeySequence]") {
+  auto names = 0;
+  for (auto key_code = 1; key_code < 0xFFFF; ++key_code) {
+    const auto key = static_cast<Key>(key_code);
+    if (const auto name = get_key_name(key)) {
+      INFO(name);
+      CHECK(get_key_by_name(name) == key);
+      ++names;
+    }
+  }
+  CHECK(names > 150);
+
+  CHECK(get_key_by_name("KeyA") == Key::A);
+  CHECK(get_key_by_name("Digit1") == Key::Digit1);
+  CHECK(get_key_by_name("1") == Key::Digit1);
+  CHECK(get_key_by_name("Any") == Key::any);
+  CHECK(get_key_by_name("Virtual3") == static_cast<Key>(*Key::first_virtual + 3));
+  CHECK(get_key_by_name("") == Key::none);
+  CHECK(get_key_by_name("Key") == Key::none);
+  CHECK(get_key_by_name("a") == Key::none);
+  CHECK(get_key_by_name("ShiftLeftX") == Key::none);
+  CHECK(get_key_name(Key::none) == nullptr);
+  CHECK(get_key_name(Key::timeout) == nullptr);
+}
+
+//--------------------------------------------------------------------
@@ -1,6 +1,11 @@
 
 #include "test.h"
 #include "config/ParseConfig.h"
+#include "config/ContextMatcher.h"
+#include "config/optimize_config.h"
+#include "client/write_config.h"
+#include <filesystem>
+#include <fstream>
 
 namespace {
   Config parse_config(const char* config) {
@@ -20,6 +25,21 @@ namespace {
       });
     return (it == end ? 0 : std::distance(begin, it) + 1);
   }
+
+  // the serialized contents of a context, which the server compiles
+  std::vector<char> serialize_context(const Config::Context& context) {
+    auto config = Config{ };
+    config.contexts.push_back(context);
+    auto s = Serializer();
+    auto context_hashes = std::vector<uint64_t>();
+    write_config(s, config, 0, 0, { }, &context_hashes);
+    return { s.data(), s.data() + s.size() };
+  }
+
+  void write_file(const std::filesystem::path& filename, const char* contents) {
+    auto os = std::ofstream(filename, std::ios::out | std::ios::binary);
+    os << contents;
+  }
 } // namespace
 
 //--------------------------------------------------------------------
@@ -418,12 +438,13 @@ TEST_CASE("Logical keys", "[ParseConfig]") {
   )";
   auto config = parse_config(string);
   REQUIRE(config.contexts.size() == 1);
-  REQUIRE(config.contexts[0].inputs.size() == 2);
+  REQUIRE(config.contexts[0].inputs.size() == 1);
   REQUIRE(config.contexts[0].outputs.size() == 1);
-  CHECK(format_sequence(config.contexts[0].inputs[0].input) == "+IntlBackslash +A ~A ~IntlBackslash");
+  CHECK(format_sequence(config.contexts[0].inputs[0].input) == "+Logical3 +A ~A ~Logical3");
   CHECK(config.contexts[0].inputs[0].output_index == 0);
-  CHECK(format_sequence(config.contexts[0].inputs[1].input) == "+AltRight +A ~A ~AltRight");
-  CHECK(config.contexts[0].inputs[1].output_index == 0);
+  REQUIRE(config.logical_keys.size() == 4);
+  CHECK(format_list(config.logical_keys[0]) == "ShiftLeft ShiftRight");
+  CHECK(format_list(config.logical_keys[3]) == "IntlBackslash AltRight");
 
   string = R"(
     Ext = IntlBackslash | AltRight
@@ -433,11 +454,11 @@ TEST_CASE("Logical keys", "[ParseConfig]") {
   )";
   config = parse_config(string);
   REQUIRE(config.contexts.size() == 1);
-  REQUIRE(config.contexts[0].inputs.size() == 3);
+  REQUIRE(config.contexts[0].inputs.size() == 1);
   REQUIRE(config.contexts[0].outputs.size() == 1);
-  CHECK(format_sequence(config.contexts[0].inputs[0].input) == "+IntlBackslash +A ~A ~IntlBackslash");
-  CHECK(format_sequence(config.contexts[0].inputs[1].input) == "+AltRight +A ~A ~AltRight");
-  CHECK(format_sequence(config.contexts[0].inputs[2].input) == "+AltLeft +A ~A ~AltLeft");
+  CHECK(format_sequence(config.contexts[0].inputs[0].input) == "+Logical4 +A ~A ~Logical4");
+  REQUIRE(config.logical_keys.size() == 5);
+  CHECK(format_list(config.logical_keys[4]) == "IntlBackslash AltRight AltLeft");
 
   string = R"(
     Ext = IntlBackslash | AltRight | AltLeft
@@ -446,12 +467,12 @@ TEST_CASE("Logical keys", "[ParseConfig]") {
   )";
   config = parse_config(string);
   REQUIRE(config.contexts.size() == 1);
-  REQUIRE(config.contexts[0].inputs.size() == 3);
+  REQUIRE(config.contexts[0].inputs.size() == 1);
   REQUIRE(config.contexts[0].outputs.size() == 1);
-  CHECK(format_sequence(config.contexts[0].inputs[0].input) == "+IntlBackslash +A ~A ~IntlBackslash");
-  CHECK(format_sequence(config.contexts[0].inputs[1].input) == "+AltRight +A ~A ~AltRight");
-  CHECK(format_sequence(config.contexts[0].inputs[2].input) == "+AltLeft +A ~A ~AltLeft");
+  CHECK(format_sequence(config.contexts[0].inputs[0].input) == "+Logical4 +A ~A ~Logical4");
   CHECK(format_sequence(config.contexts[0].outputs[0]) == "+A -A +Action0 +B -B");
+  REQUIRE(config.logical_keys.size() == 5);
+  CHECK(format_list(config.logical_keys[4]) == "IntlBackslash AltRight AltLeft");
   REQUIRE(config.actions.size() == 1);
   CHECK(config.actions[0].terminal_command == "ls -la | grep xy");
 
@@ -466,17 +487,370 @@ TEST_CASE("Logical keys", "[ParseConfig]") {
 TEST_CASE("Logical keys 2", "[ParseConfig]") {
   auto string = R"(
     Shift{A} >> Shift{B}
+    C >> !Control D
+    Meta{C} >> command
+    command >> Meta{E}
   )";
 
   auto config = parse_config(string);
   REQUIRE(config.contexts.size() == 1);
-  REQUIRE(config.contexts[0].inputs.size() == 2);
+  REQUIRE(config.contexts[0].inputs.size() == 3);
   REQUIRE(config.contexts[0].outputs.size() == 2);
-  REQUIRE(format_sequence(config.contexts[0].inputs[0].input) == "+ShiftLeft +A ~A ~ShiftLeft");
-  REQUIRE(format_sequence(config.contexts[0].inputs[1].input) == "+ShiftRight +A ~A ~ShiftRight");
-  REQUIRE(format_sequence(config.contexts[0].outputs[0]) == "+ShiftLeft +B -B -ShiftLeft");
-  REQUIRE(format_sequence(config.contexts[0].outputs[1]) == "+ShiftRight +B -B -ShiftRight");
+  REQUIRE(config.contexts[0].command_outputs.size() == 1);
+  CHECK(format_sequence(config.contexts[0].inputs[0].input) == "+Logical0 +A ~A ~Logical0");
+  CHECK(format_sequence(config.contexts[0].outputs[0]) == "+Logical0 +B -B -Logical0");
+  CHECK(format_sequence(config.contexts[0].outputs[1]) == "!ControlLeft !ControlRight +D");
+  // command outputs can not depend on the matched key
+  CHECK(format_sequence(config.contexts[0].command_outputs[0].output) == "+MetaLeft +E -E -MetaLeft");
+
+  // inputs are not duplicated per combination of keys
+  config = parse_config("Shift{Control{Meta{A}}} >> Meta{B}");
+  REQUIRE(config.contexts.size() == 1);
+  REQUIRE(config.contexts[0].inputs.size() == 1);
+  REQUIRE(config.contexts[0].outputs.size() == 1);
+  CHECK(format_sequence(config.contexts[0].inputs[0].input) ==
+    "+Logical0 +Logical1 +Logical2 +A ~A ~Logical2 ~Logical1 ~Logical0");
 }
 
 //--------------------------------------------------------------------
 
+TEST_CASE("Context matcher", "[ParseConfig]") {
+  auto string = R"(
+    [title = "Title"]
+    A >> B
+
+    [class = "Class"]
+    A >> C
+
+    [title = /Title\d/]
+    A >> D
+  )";
+
+  auto config = parse_config(string);
+  auto matcher = ContextMatcher();
+  matcher.set_contexts(&config.contexts);
+  using List = std::vector<int>;
+
+  CHECK(matcher.match("Some", "Some") == List{ });
+  CHECK(matcher.match("Some", "Title") == List{ 0 });
+  CHECK(matcher.match("Class", "Title1") == List{ 0, 1, 2 });
+  CHECK(matcher.cache_hits() == 0);
+  CHECK(matcher.match("Some", "Title") == List{ 0 });
+  CHECK(matcher.match("Class", "Title1") == List{ 0, 1, 2 });
+  CHECK(matcher.cache_hits() == 2);
+
+  // evict least recently used
+  for (auto i = 0; i < 100; ++i)
+    CHECK(matcher.match("Class", "Title" + std::to_string(i + 10)).size() == 3);
+  CHECK(matcher.match("Some", "Title") == List{ 0 });
+  CHECK(matcher.cache_hits() == 2);
+  
+  // invalidated when contexts change
+  auto config2 = parse_config("[class='Some'] \n A >> B");
+  matcher.set_contexts(&config2.contexts);
+  CHECK(matcher.match("Some", "Title") == List{ 0 });
+  CHECK(matcher.match("Class", "Title1") == List{ });
+  CHECK(matcher.cache_hits() == 2);
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Context matcher with many filters", "[ParseConfig]") {
+  auto string = R"(
+    [title = "he"]
+    A >> B
+    [title = "she"]
+    A >> B
+    [title = "his"]
+    A >> B
+    [title = "hers"]
+    A >> B
+    [class = "Class" title = "hers"]
+    A >> B
+    [class = "Class2"]
+    A >> B
+    [title = /^h.s$/]
+    A >> B
+    [class = /^h.s$/ title = "she"]
+    A >> B
+    [title = /s$/i]
+    A >> B
+  )";
+
+  auto config = parse_config(string);
+  auto matcher = ContextMatcher();
+  matcher.set_contexts(&config.contexts);
+  for (const auto& [window_class, window_title] : {
+      std::pair{ "Class", "ushers" },
+      std::pair{ "Class2", "his" },
+      std::pair{ "his", "she" },
+      std::pair{ "Some", "HERS" },
+      std::pair{ "", "" },
+      std::pair{ "Class", "hehe" },
+    }) {
+    auto expected = std::vector<int>();
+    for (auto i = 0; i < static_cast<int>(config.contexts.size()); ++i)
+      if (config.contexts[i].matches(window_class, window_title))
+        expected.push_back(i);
+    CHECK(matcher.match(window_class, window_title) == expected);
+  }
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Reparse changed context", "[ParseConfig]") {
+  auto string = std::string(R"(
+    A >> B
+    [class="a"]
+    C >> $(echo a)
+    [class="b"]
+    D >> E
+  )");
+
+  auto parse = ParseConfig();
+  const auto config = parse(string);
+  REQUIRE(config.contexts.size() == 3);
+  for (const auto& context : config.contexts)
+    CHECK(context.hash != 0);
+  CHECK(config.contexts[1].hash != config.contexts[2].hash);
+
+  // unchanged contexts keep their hash
+  string.replace(string.find("$(echo a)"), 9, "$(echo b)");
+  const auto changed = parse(string);
+  REQUIRE(changed.contexts.size() == 3);
+  CHECK(changed.contexts[0].hash == config.contexts[0].hash);
+  CHECK(changed.contexts[1].hash != config.contexts[1].hash);
+  CHECK(changed.contexts[2].hash == config.contexts[2].hash);
+  CHECK(changed.actions[0].terminal_command == "echo b");
+
+  // reused key sequences are the same as freshly parsed ones
+  const auto fresh = ParseConfig()(string);
+  for (auto i = 0u; i < fresh.contexts.size(); ++i) {
+    CHECK(changed.contexts[i].hash == fresh.contexts[i].hash);
+    const auto& inputs = changed.contexts[i].inputs;
+    const auto& fresh_inputs = fresh.contexts[i].inputs;
+    REQUIRE(inputs.size() == fresh_inputs.size());
+    for (auto j = 0u; j < inputs.size(); ++j) {
+      CHECK(inputs[j].input == fresh_inputs[j].input);
+      CHECK(inputs[j].output_index == fresh_inputs[j].output_index);
+    }
+    CHECK(changed.contexts[i].outputs == fresh.contexts[i].outputs);
+  }
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Rehash contexts using changed logical key", "[ParseConfig]") {
+  auto string = std::string(R"(
+    Ext = IntlBackslash | AltRight
+    A >> B
+    E >> command
+    [class="a"]
+    C >> !Ext D
+    [class="b"]
+    command >> Ext
+    [class="c"]
+    F >> G
+  )");
+
+  auto parse = ParseConfig();
+  const auto config = parse(string);
+  REQUIRE(config.contexts.size() == 4);
+
+  // only the contexts which resolve the logical key change
+  string.replace(string.find("IntlBackslash | AltRight"), 24,
+    "AltLeft | ControlRight");
+  const auto changed = parse(string);
+  REQUIRE(changed.contexts.size() == 4);
+  CHECK(changed.contexts[0].hash == config.contexts[0].hash);
+  CHECK(changed.contexts[1].hash != config.contexts[1].hash);
+  CHECK(changed.contexts[2].hash != config.contexts[2].hash);
+  CHECK(changed.contexts[3].hash == config.contexts[3].hash);
+}
+
+TEST_CASE("Equal context hashes identify equal contents", "[ParseConfig]") {
+  const auto strings = std::vector<std::string>{
+    R"(
+      Ext = IntlBackslash | AltRight
+      A >> B
+      E >> command
+      [class="a"]
+      C >> !Ext D $(echo a)
+      [class="b"]
+      command >> Ext
+    )",
+    R"(
+      Ext = AltLeft | ControlRight
+      A >> B
+      E >> command
+      [class="a"]
+      C >> !Ext D $(echo a)
+      [class="b"]
+      command >> Ext
+    )",
+    R"(
+      Ext = AltLeft | ControlRight
+      A >> B
+      E >> command
+      X >> $(echo x)
+      [class="a"]
+      C >> !Ext D $(echo a)
+      [class="b"]
+      command >> Ext
+    )",
+    R"(
+      Ext = AltLeft | ControlRight
+      A >> B
+      E >> command
+      [class="a"]
+      C >> !Ext D $(echo b)
+      [class="b" device="x"]
+      command >> Ext
+    )",
+  };
+
+  // parse in sequence, to also compare contexts which were reused
+  auto parse = ParseConfig();
+  auto contexts = std::vector<Config::Context>();
+  for (const auto& string : strings) {
+    auto config = parse(string);
+    for (auto& context : config.contexts)
+      contexts.push_back(std::move(context));
+  }
+
+  // the server only receives contexts whose hash it does not know yet
+  auto equal_hashes = 0;
+  for (const auto& a : contexts)
+    for (const auto& b : contexts)
+      if (a.hash == b.hash) {
+        CHECK(serialize_context(a) == serialize_context(b));
+        ++equal_hashes;
+      }
+  CHECK(equal_hashes > static_cast<int>(contexts.size()));
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Include files", "[ParseConfig]") {
+  const auto directory = std::filesystem::temp_directory_path() /
+    "keymapper-test-include";
+  std::filesystem::create_directories(directory / "sub");
+  write_file(directory / "sub" / "fragment.conf", R"(
+    A >> command
+    @include "../common.conf"
+    [class="a"]
+    command >> Macro
+  )");
+  write_file(directory / "common.conf", R"(
+    B >> C
+  )");
+
+  auto parse = ParseConfig();
+  auto config = parse(R"(
+    Macro = D
+    @include sub/fragment.conf   # comment
+    [class="b"]
+    command >> E
+  )", directory);
+  REQUIRE(config.contexts.size() == 3);
+  CHECK(config.contexts[0].inputs.size() == 2);
+  CHECK(config.contexts[1].command_outputs[0].output == parse_sequence("+D"));
+  CHECK(parse.included_files().size() == 2);
+
+  // modified files are read again
+  write_file(directory / "common.conf", R"(
+    B >> C
+    C >> B
+  )");
+  config = parse(R"(
+    Macro = D
+    @include sub/fragment.conf
+  )", directory);
+  REQUIRE(config.contexts.size() == 2);
+  CHECK(config.contexts[0].inputs.size() == 3);
+
+  // errors report the file
+  write_file(directory / "common.conf", R"(
+    B >> C
+    C >> Unknown{
+  )");
+  try {
+    parse("Macro = D\n@include sub/fragment.conf", directory);
+    FAIL();
+  }
+  catch (const std::exception& ex) {
+    const auto message = std::string(ex.what());
+    CHECK(message.find("in line 3 of '") != std::string::npos);
+    CHECK(message.find("common.conf'") != std::string::npos);
+  }
+
+  // recursive include
+  write_file(directory / "common.conf", R"(
+    @include sub/fragment.conf
+  )");
+  CHECK_THROWS(parse("@include common.conf", directory));
+
+  // missing file and unknown directive
+  CHECK_THROWS(parse("@include missing.conf", directory));
+  CHECK_THROWS(parse("@include", directory));
+  CHECK_THROWS(parse("@unknown", directory));
+
+  std::filesystem::remove_all(directory);
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Optimize config", "[ParseConfig]") {
+  auto string = R"(
+    A >> B
+    C >> command
+    A >> C          # shadowed
+    D >> B          # merged with first output
+    E 500ms >> B    # not merged, since it has a timeout
+
+    [class="a"]
+    A >> D          # shadowed by always active context
+    E >> F
+    E >> G          # shadowed
+    command >> X    # overridden by always active context
+
+    [class="b"]
+    A >> X          # shadowed, context becomes empty
+
+    [default]
+    command >> Y
+  )";
+
+  auto config = parse_config(string);
+  REQUIRE(config.contexts.size() == 4);
+  const auto hash = config.contexts[3].hash;
+
+  const auto optimizations = optimize_config(config);
+  CHECK(optimizations.shadowed_inputs == 4);
+  CHECK(optimizations.unreachable_command_outputs == 1);
+  CHECK(optimizations.duplicate_outputs == 1);
+  CHECK(optimizations.empty_contexts == 1);
+
+  REQUIRE(config.contexts.size() == 3);
+  const auto& inputs = config.contexts[0].inputs;
+  REQUIRE(inputs.size() == 4);
+  CHECK(inputs[0].input == parse_input("A"));
+  CHECK(inputs[2].input == parse_input("D"));
+  CHECK(inputs[2].output_index == inputs[0].output_index);
+  CHECK(inputs[3].output_index != inputs[0].output_index);
+  CHECK(config.contexts[0].outputs.size() == 2);
+  CHECK(config.contexts[1].inputs.size() == 1);
+  CHECK(config.contexts[1].command_outputs.empty());
+  CHECK(config.contexts[2].command_outputs.size() == 1);
+
+  // only unmodified contexts keep their hash
+  CHECK(config.contexts[0].hash == 0);
+  CHECK(config.contexts[2].hash == hash);
+
+  // nothing left to optimize
+  const auto again = optimize_config(config);
+  CHECK(again.shadowed_inputs == 0);
+  CHECK(again.unreachable_command_outputs == 0);
+  CHECK(again.duplicate_outputs == 0);
+  CHECK(again.empty_contexts == 0);
+}
@@ -276,3 +276,55 @@ TEST_CASE("Match Not Timeout", "[MatchKeySequence]") {
   CHECK(input_timeout_event == KeyEvent{ });
 }
 //--------------------------------------------------------------------
+
+TEST_CASE("Match logical keys", "[MatchKeySequence]") {
+  auto match = MatchKeySequence();
+  match.set_logical_keys({ { Key::ShiftLeft, Key::ShiftRight } });
+  const auto shift = Key::first_logical;
+  const auto to_logical = [&](KeySequence sequence) {
+    for (auto& event : sequence)
+      if (event.key == Key::ShiftLeft)
+        event.key = shift;
+    return sequence;
+  };
+  auto any_key_matches = std::vector<Key>();
+  auto input_timeout_event = KeyEvent{ };
+  const auto match_sequence = [&](const KeySequence& expr,
+                                  const KeySequence& sequence) {
+    return match(expr, sequence, &any_key_matches, &input_timeout_event);
+  };
+
+  // "Shift{A}"  =>  +Shift +A ~A ~Shift
+  auto expr = to_logical(parse_input("ShiftLeft{A}"));
+  CHECK(match_sequence(expr, parse_sequence("+ShiftLeft +A")) == MatchResult::match);
+  CHECK(match.get_logical_key_match(shift) == Key::ShiftLeft);
+  CHECK(match_sequence(expr, parse_sequence("+ShiftRight +A")) == MatchResult::match);
+  CHECK(match.get_logical_key_match(shift) == Key::ShiftRight);
+  CHECK(match_sequence(expr, parse_sequence("+ShiftRight")) == MatchResult::might_match);
+  CHECK(match_sequence(expr, parse_sequence("+ControlLeft +A")) == MatchResult::no_match);
+  CHECK(match_sequence(expr, parse_sequence("+ShiftRight -ShiftRight +A")) == MatchResult::no_match);
+
+  // logical key is bound to the key it matched first
+  expr = to_logical(parse_input("ShiftLeft ShiftLeft"));
+  CHECK(match_sequence(expr, parse_sequence("+ShiftLeft -ShiftLeft +ShiftLeft")) == MatchResult::match);
+  CHECK(match_sequence(expr, parse_sequence("+ShiftRight -ShiftRight +ShiftRight")) == MatchResult::match);
+  CHECK(match_sequence(expr, parse_sequence("+ShiftLeft -ShiftLeft +ShiftRight")) == MatchResult::no_match);
+
+  // "(Shift A)"  =>  *Shift *A +Shift +A
+  expr = to_logical(parse_input("(ShiftLeft A)"));
+  CHECK(match_sequence(expr, parse_sequence("+A +ShiftRight")) == MatchResult::match);
+  CHECK(match_sequence(expr, parse_sequence("+ShiftLeft +A")) == MatchResult::match);
+  CHECK(match_sequence(expr, parse_sequence("+A +ShiftRight -ShiftRight")) == MatchResult::no_match);
+
+  // "B !Shift C"
+  expr = to_logical(parse_input("B !ShiftLeft C"));
+  CHECK(match_sequence(expr, parse_sequence("+B +C")) == MatchResult::match);
+  CHECK(match_sequence(expr, parse_sequence("+B +ShiftLeft +C")) == MatchResult::no_match);
+  CHECK(match_sequence(expr, parse_sequence("+B +ShiftRight +C")) == MatchResult::no_match);
+
+  // outputs first key when not matched
+  CHECK(match_sequence(expr, parse_sequence("+B +C")) == MatchResult::match);
+  CHECK(match.get_logical_key_match(shift) == Key::ShiftLeft);
+}
+
+//--------------------------------------------------------------------
@@ -983,6 +983,36 @@ TEST_CASE("Restore default context", "[Stage]") {
 
 //--------------------------------------------------------------------
 
+TEST_CASE("Switching between many active contexts", "[Stage]") {
+  // more contexts than fit in one word of context bits
+  auto config = std::string("A >> command\n");
+  for (auto i = 0; i < 80; ++i)
+    config += "[title=\"" + std::to_string(i) + "\"]\n" +
+      "command >> " + (i % 2 ? "B" : "C") + "\n";
+  Stage stage = create_stage(config.c_str());
+  REQUIRE(stage.contexts().size() == 81);
+
+  // switch between more sets than are cached
+  for (auto pass = 0; pass < 2; ++pass)
+    for (auto i = 1; i <= 80; ++i) {
+      stage.set_active_contexts({ 0, i });
+      if (i % 2)
+        REQUIRE(apply_input(stage, "+A -A") == "+C -C");
+      else
+        REQUIRE(apply_input(stage, "+A -A") == "+B -B");
+    }
+
+  // last context overrides command
+  stage.set_active_contexts({ 0, 1, 2, 79, 80 });
+  REQUIRE(apply_input(stage, "+A -A") == "+B -B");
+  stage.set_active_contexts({ 0, 1, 2, 79 });
+  REQUIRE(apply_input(stage, "+A -A") == "+C -C");
+  stage.set_active_contexts({ 0, 1, 2, 79, 80 });
+  REQUIRE(apply_input(stage, "+A -A") == "+B -B");
+}
+
+//--------------------------------------------------------------------
+
 TEST_CASE("Trigger action", "[Stage]") {
   auto config = R"(
     A >> A $(system command 1)
@@ -1624,3 +1654,35 @@ TEST_CASE("Timeout Morse", "[Stage]") {
   CHECK(apply_input(stage, make_timeout_ms(500)) == "+D -D");
   REQUIRE(stage.is_clear());
 }
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Logical key classes", "[Stage]") {
+  auto config = R"(
+    Ext = IntlBackslash | AltRight
+    Ext2 = Ext | AltLeft
+    Ext2{A} >> Ext2{B}
+    Shift{C} >> Ext{D}
+  )";
+  Stage stage = create_stage(config);
+
+  // outputs key the logical key was matched with
+  CHECK(apply_input(stage, "+AltLeft") == "");
+  CHECK(apply_input(stage, "+A") == "+AltLeft +B -B -AltLeft");
+  CHECK(apply_input(stage, "-A") == "");
+  CHECK(apply_input(stage, "-AltLeft") == "");
+  REQUIRE(stage.is_clear());
+
+  CHECK(apply_input(stage, "+AltRight") == "");
+  CHECK(apply_input(stage, "+A") == "+AltRight +B -B -AltRight");
+  CHECK(apply_input(stage, "-A") == "");
+  CHECK(apply_input(stage, "-AltRight") == "");
+  REQUIRE(stage.is_clear());
+
+  // outputs first key when it was not matched
+  CHECK(apply_input(stage, "+ShiftRight") == "");
+  CHECK(apply_input(stage, "+C") == "+IntlBackslash +D -D -IntlBackslash");
+  CHECK(apply_input(stage, "-C") == "");
+  CHECK(apply_input(stage, "-ShiftRight") == "");
+  REQUIRE(stage.is_clear());
+}
@@ -0,0 +1,276 @@
+
+#include "test.h"
+#include "config/ParseConfig.h"
+#include "config/ContextMatcher.h"
+#include "common/Connection.h"
+#include "common/Regex.h"
+#include <regex>
+#include <algorithm>
+
+// benchmarks are hidden, run with: test-keymapper [Benchmark]
+
+namespace {
+  std::string generate_config(int mappings) {
+    const auto keys = std::vector<std::string>{
+      "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M",
+      "N", "O", "P", "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z" };
+    const auto key = [&](int i) { return keys[i % keys.size()]; };
+    auto config = std::string();
+    for (auto i = 0; i < mappings; ++i) {
+      if (i % 100 == 0)
+        config += "[title=\"" + std::to_string(i) + "\"]\n";
+      config += "Control{" + key(i) + " " + key(i / 26) + "} >> " +
+        "Shift{" + key(i + 1) + "} " + key(i / 13) + "\n";
+    }
+    return config;
+  }
+
+  std::string generate_context_config(int contexts, bool with_regex) {
+    auto config = std::string();
+    for (auto i = 0; i < contexts; ++i) {
+      const auto name = "Application" + std::to_string(i);
+      switch (i % 4) {
+        case 0: config += "[class=\"" + name + "\"]\n"; break;
+        case 1: config += "[title=\"" + name + "\"]\n"; break;
+        case 2: config += "[class=\"Browser\" title=\"" + name + "\"]\n"; break;
+        case 3: config += (with_regex ?
+          "[title=/" + name + "\\s\\d+/i]\n" :
+          "[title=\"" + name + " \"]\n"); break;
+      }
+      config += "A >> B\n";
+    }
+    return config;
+  }
+
+  // a config with many macros, logical keys and commands
+  std::string generate_large_config(int lines) {
+    const auto key = [](int i) { return std::string(1, static_cast<char>('A' + i % 26)); };
+    const auto macros = lines / 10;
+    const auto logical_keys = 50;
+    const auto commands = (lines - macros - logical_keys) / 2;
+    auto config = std::string();
+    for (auto i = 0; i < macros; ++i)
+      config += "macro" + std::to_string(i) + " = Shift{" + key(i) + "} " + key(i / 26) + "\n";
+    for (auto i = 0; i < logical_keys; ++i)
+      config += "Logical" + std::to_string(i) + " = " + key(i) + " | " + key(i + 1) + "\n";
+    for (auto i = 0; i < commands; ++i)
+      config += "Control{" + key(i) + " " + key(i / 26) + "} Logical" +
+        std::to_string(i % logical_keys) + " >> command" + std::to_string(i) + "\n";
+    for (auto i = 0; i < commands; ++i) {
+      if (i % 100 == 0)
+        config += "[title=\"" + std::to_string(i) + "\"]\n";
+      config += "command" + std::to_string(i) + " >> macro" +
+        std::to_string(i % macros) + " " + key(i) + "\n";
+    }
+    return config;
+  }
+
+  Config parse_config(const std::string& string) {
+    auto stream = std::stringstream(string);
+    return ParseConfig()(stream);
+  }
+
+  std::vector<const KeySequence*> get_sequences(const Config& config) {
+    auto sequences = std::vector<const KeySequence*>();
+    for (const auto& context : config.contexts) {
+      for (const auto& input : context.inputs)
+        sequences.push_back(&input.input);
+      for (const auto& output : context.outputs)
+        sequences.push_back(&output);
+    }
+    return sequences;
+  }
+
+  Deserializer to_deserializer(const Serializer& s) {
+    return Deserializer(std::vector<char>(s.data(), s.data() + s.size()));
+  }
+} // namespace
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Parse config", "[.][Benchmark]") {
+  const auto config = generate_large_config(50000);
+  REQUIRE(std::count(config.begin(), config.end(), '\n') >= 50000);
+
+  BENCHMARK("Parse 50k lines") {
+    return parse_config(config);
+  };
+
+  // only the last context differs
+  const auto configs = std::vector<std::string>{
+    config + "[title=\"changed\"]\nA >> B\n",
+    config + "[title=\"changed\"]\nA >> C\n",
+  };
+  auto parse = ParseConfig();
+  auto i = 0;
+  BENCHMARK("Reparse 50k lines with one changed context") {
+    return parse(std::string_view(configs[i++ % 2]));
+  };
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Serialize key sequences", "[.][Benchmark]") {
+  const auto config = parse_config(generate_config(10000));
+  const auto sequences = get_sequences(config);
+  // logical key Control duplicates each input
+  REQUIRE(sequences.size() == 30000);
+
+  BENCHMARK("Serialize per event") {
+    auto s = Serializer();
+    for (const auto* sequence : sequences) {
+      s.write(static_cast<uint32_t>(sequence->size()));
+      for (const auto& event : *sequence) {
+        s.write(event.key);
+        s.write(event.data);
+      }
+    }
+    return s.size();
+  };
+
+  BENCHMARK("Serialize bulk") {
+    auto size = size_t{ };
+    for (const auto* sequence : sequences)
+      size += sizeof(uint32_t) + sequence->size() * sizeof(KeyEvent);
+    auto s = Serializer();
+    s.reserve(size);
+    for (const auto* sequence : sequences)
+      s.write_array(*sequence);
+    return s.size();
+  };
+
+  auto s = Serializer();
+  for (const auto* sequence : sequences)
+    s.write_array(*sequence);
+
+  BENCHMARK_ADVANCED("Deserialize per event")(Catch::Benchmark::Chronometer meter) {
+    auto deserializers = std::vector<Deserializer>();
+    for (auto i = 0; i < meter.runs(); ++i)
+      deserializers.push_back(to_deserializer(s));
+    meter.measure([&](int run) {
+      auto& d = deserializers[run];
+      auto count = size_t{ };
+      for (auto i = 0u; i < sequences.size(); ++i) {
+        auto sequence = KeySequence();
+        const auto size = d.read<uint32_t>();
+        for (auto j = 0u; j < size; ++j) {
+          auto& event = sequence.emplace_back();
+          d.read(&event.key);
+          d.read(&event.data);
+        }
+        count += sequence.size();
+      }
+      return count;
+    });
+  };
+
+  BENCHMARK_ADVANCED("Deserialize bulk")(Catch::Benchmark::Chronometer meter) {
+    auto deserializers = std::vector<Deserializer>();
+    for (auto i = 0; i < meter.runs(); ++i)
+      deserializers.push_back(to_deserializer(s));
+    meter.measure([&](int run) {
+      auto& d = deserializers[run];
+      auto count = size_t{ };
+      for (auto i = 0u; i < sequences.size(); ++i) {
+        auto sequence = KeySequence();
+        d.read_array(&sequence);
+        count += sequence.size();
+      }
+      return count;
+    });
+  };
+
+  // check round trip
+  auto d = to_deserializer(s);
+  for (const auto* sequence : sequences) {
+    auto read = KeySequence();
+    d.read_array(&read);
+    REQUIRE(read == *sequence);
+  }
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Match contexts", "[.][Benchmark]") {
+  const auto window_class = std::string("Browser");
+  auto titles = std::vector<std::string>();
+  for (auto i = 0; i < 1000; ++i)
+    titles.push_back("Application" + std::to_string(i % 500) +
+      " - Document " + std::to_string(i));
+
+  for (auto with_regex : { false, true }) {
+    const auto config = parse_config(generate_context_config(400, with_regex));
+    REQUIRE(config.contexts.size() == 400);
+    const auto suffix = std::string(with_regex ? " (with regex)" : "");
+
+    BENCHMARK("Match each context" + suffix) {
+      auto count = size_t{ };
+      for (const auto& title : titles)
+        for (const auto& context : config.contexts)
+          if (context.matches(window_class, title))
+            ++count;
+      return count;
+    };
+
+    BENCHMARK_ADVANCED("Match combined" + suffix)(Catch::Benchmark::Chronometer meter) {
+      // distinct titles, so the cache is not hit
+      auto matcher = ContextMatcher();
+      matcher.set_contexts(&config.contexts);
+      meter.measure([&]() {
+        auto count = size_t{ };
+        for (const auto& title : titles)
+          count += matcher.match(window_class, title).size();
+        return count;
+      });
+    };
+
+    auto matcher = ContextMatcher();
+    matcher.set_contexts(&config.contexts);
+    for (const auto& title : titles) {
+      auto expected = std::vector<int>();
+      for (auto i = 0; i < static_cast<int>(config.contexts.size()); ++i)
+        if (config.contexts[i].matches(window_class, title))
+          expected.push_back(i);
+      REQUIRE(matcher.match(window_class, title) == expected);
+    }
+  }
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Search regex", "[.][Benchmark]") {
+  const auto pattern = std::string("^Application\\d+ - (Document|Sheet) \\d+$");
+  auto titles = std::vector<std::string>();
+  for (auto i = 0; i < 1000; ++i)
+    titles.push_back("Application" + std::to_string(i % 500) +
+      (i % 2 ? " - Document " : " - Draft ") + std::to_string(i));
+
+  BENCHMARK("Construct std::regex") {
+    return std::regex(pattern, std::regex::icase);
+  };
+
+  BENCHMARK("Construct Regex") {
+    return Regex(pattern, true);
+  };
+
+  const auto std_regex = std::regex(pattern, std::regex::icase);
+  BENCHMARK("Search std::regex") {
+    auto count = size_t{ };
+    for (const auto& title : titles)
+      if (std::regex_search(title, std_regex))
+        ++count;
+    return count;
+  };
+
+  const auto regex = Regex(pattern, true);
+  BENCHMARK("Search Regex") {
+    auto count = size_t{ };
+    for (const auto& title : titles)
+      if (regex.search(title))
+        ++count;
+    return count;
+  };
+
+  for (const auto& title : titles)
+    REQUIRE(regex.search(title) == std::regex_search(title, std_regex));
+}
@@ -0,0 +1,91 @@
+
+#include "test.h"
+#include "common/Regex.h"
+#include <regex>
+
+namespace {
+  bool std_search(const char* pattern, bool icase, const std::string& text) {
+    auto flags = std::regex::ECMAScript;
+    if (icase)
+      flags |= std::regex::icase;
+    return std::regex_search(text, std::regex(pattern, flags));
+  }
+} // namespace
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Regex matches like std::regex", "[Regex]") {
+  const auto patterns = {
+    "abc", "^abc", "abc$", "^abc$", "^$", "", "a.c", "a.*c", "a.+c",
+    "ab?c", "ab*c", "ab+c", "a(bc)+d", "a(?:bc)*d", "a|b", "^(a|bc)$",
+    "x{2}", "x{2,}", "^x{1,3}$", "x{0,1}y", "[abc]+", "[^abc]", "^[a-z]+$",
+    "[A-Z][a-z]*", "\\d+", "^\\d{3}-\\d{4}$", "\\w+\\s\\w+", "\\D\\W\\S",
+    "[\\d.]+", "\\.", "a\\+b", "\\x41", "[\\]]", "[-a]", "a.*?c",
+    "^(Firefox|Chromium)$", "Visual Studio Code$", "^.*- Mozilla Firefox$",
+    "(^|\\s)vim($|\\s)", "[[]",
+    // unsupported by the DFA
+    "\\bword\\b", "(a)\\1", "a(?=b)", "[[:digit:]]+", "^(?!x)",
+  };
+  const auto texts = {
+    "", "abc", "xabcx", "ac", "abbbc", "abcbcd", "ad", "a", "b", "bc",
+    "xx", "xxx", "x", "y", "xy", "ABC", "Abc", "aBc", "123", "555-1234",
+    "hello world", "a+b", "A", "]", "-", "a.b.c", "Firefox", "Chromium",
+    "Firefox - Mozilla Firefox", "code - Visual Studio Code", "vim", "gvim",
+    "edit vim", "[", "a{,2}", "word", "a word here", "aa", "ab", "xa",
+  };
+
+  for (auto icase : { false, true })
+    for (auto pattern : patterns) {
+      const auto regex = Regex(pattern, icase);
+      for (auto text : texts) {
+        INFO(pattern << " / " << text << " / " << icase);
+        CHECK(regex.search(text) == std_search(pattern, icase, text));
+      }
+    }
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Regex set", "[Regex]") {
+  auto set = RegexSet();
+  CHECK(set.add("^abc", false) == 0);
+  CHECK(set.add("b+", false) == 1);
+  CHECK(set.add("C$", true) == 2);
+  CHECK(set.add("\\bx", false) == 3);
+  CHECK(set.size() == 4);
+
+  auto matches = std::vector<int>();
+  set.search("abc", &matches);
+  CHECK(matches == (std::vector<int>{ 0, 1, 2 }));
+  set.search("xbb", &matches);
+  CHECK(matches == (std::vector<int>{ 1, 3 }));
+  set.search("zzz", &matches);
+  CHECK(matches.empty());
+  CHECK(set.search_any("ABC"));
+  CHECK(!set.search_any("a"));
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Regex invalid patterns", "[Regex]") {
+  CHECK_THROWS_AS(Regex("(abc", false), std::regex_error);
+  CHECK_THROWS_AS(Regex("abc)", false), std::regex_error);
+  CHECK_THROWS_AS(Regex("[abc", false), std::regex_error);
+  CHECK_THROWS_AS(Regex("*a", false), std::regex_error);
+  CHECK_THROWS_AS(Regex("a\\", false), std::regex_error);
+  CHECK_THROWS_AS(Regex("a{,2}", false), std::regex_error);
+  CHECK_NOTHROW(Regex("a\\*", false));
+}
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Regex DFA state limit", "[Regex]") {
+  // exceeds the cached DFA states, which are rebuilt while searching
+  auto set = RegexSet();
+  set.add("a.{12}b", false);
+  auto text = std::string();
+  for (auto i = 0; i < 5000; ++i)
+    text.push_back("ab"[(i * 7 + i / 3) % 2]);
+  CHECK(set.search_any(text) == std::regex_search(text, std::regex("a.{12}b")));
+  CHECK(set.search_any(text + "a" + std::string(12, 'x') + "b"));
+}
@@ -0,0 +1,102 @@
+
+#include "test.h"
+#include "client/write_config.h"
+#include "common/MessageType.h"
+#include "config/ParseConfig.h"
+#include "server/ClientPort.h"
+
+namespace {
+  // the message as it is sent by ServerPort
+  Deserializer make_config_message(const Config& config,
+      uint32_t base_version, uint32_t version,
+      const std::vector<uint64_t>& base_context_hashes,
+      std::vector<uint64_t>* context_hashes, int* changed = nullptr) {
+    auto s = Serializer();
+    s.write(ConfigTransfer::message);
+    const auto written = write_config(s, config, base_version, version,
+      base_context_hashes, context_hashes);
+    if (changed)
+      *changed = written;
+    return Deserializer(std::vector<char>(s.data(), s.data() + s.size()));
+  }
+
+  void check_stage_contents(const Stage& stage, const Config& config) {
+    const auto& sequences = stage.sequences();
+    const auto& contexts = stage.contexts();
+    REQUIRE(contexts.size() == config.contexts.size());
+    for (auto i = 0u; i < contexts.size(); ++i) {
+      const auto& context = contexts[i];
+      const auto& expected = config.contexts[i];
+      REQUIRE(context.inputs.size() == expected.inputs.size());
+      for (auto j = 0u; j < context.inputs.size(); ++j) {
+        CHECK(sequences.at(context.inputs[j].input) == expected.inputs[j].input);
+        CHECK(context.inputs[j].output_index == expected.inputs[j].output_index);
+      }
+      REQUIRE(context.outputs.size() == expected.outputs.size());
+      for (auto j = 0u; j < context.outputs.size(); ++j)
+        CHECK(sequences.at(context.outputs[j]) == expected.outputs[j]);
+      REQUIRE(context.command_outputs.size() == expected.command_outputs.size());
+      for (auto j = 0u; j < context.command_outputs.size(); ++j) {
+        const auto& command = context.command_outputs[j];
+        CHECK(sequences.at(command.output) == expected.command_outputs[j].output);
+        CHECK(command.index == expected.command_outputs[j].index);
+      }
+      CHECK(context.device_filter == expected.device_filter);
+    }
+  }
+} // namespace
+
+//--------------------------------------------------------------------
+
+TEST_CASE("Apply configuration updates", "[ClientPort]") {
+  auto string = std::string(R"(
+    Ext = IntlBackslash | AltRight
+    A >> B
+    E >> command
+    [class="a"]
+    C >> !Ext D
+    [class="b" device="keyboard"]
+    command >> Ext
+    [class="c"]
+    F >> G
+  )");
+  auto parse = ParseConfig();
+  auto client = ClientPort();
+
+  // complete configuration
+  const auto config = parse(string);
+  auto hashes = std::vector<uint64_t>();
+  auto changed = 0;
+  auto d = make_config_message(config, 0, 1, { }, &hashes, &changed);
+  CHECK(changed == 4);
+  auto stage = client.read_config(d);
+  REQUIRE(stage);
+  check_stage_contents(*stage, config);
+
+  // only the changed context is sent, the others are reused by index
+  string.replace(string.find("F >> G"), 6, "F >> H");
+  const auto update = parse(string);
+  auto update_hashes = std::vector<uint64_t>();
+  d = make_config_message(update, 1, 2, hashes, &update_hashes, &changed);
+  CHECK(changed == 1);
+  stage = client.read_config(d);
+  REQUIRE(stage);
+  check_stage_contents(*stage, update);
+
+  // update based on an outdated version is rejected
+  string.replace(string.find("A >> B"), 6, "A >> X");
+  const auto outdated = parse(string);
+  auto outdated_hashes = std::vector<uint64_t>();
+  d = make_config_message(outdated, 1, 3, hashes, &outdated_hashes, &changed);
+  CHECK(changed == 2);
+  CHECK(!client.read_config(d));
+
+  // which requires the complete configuration to be sent
+  d = make_config_message(outdated, 2, 3, update_hashes, &outdated_hashes);
+  CHECK(!client.read_config(d));
+  d = make_config_message(outdated, 0, 4, { }, &outdated_hashes, &changed);
+  CHECK(changed == 4);
+  stage = client.read_config(d);
+  REQUIRE(stage);
+  check_stage_contents(*stage, outdated);
+}